@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal benchmark harness. Benchmarks register themselves by name and
+// report every measurement as one JSON object per line on stdout, so runs can
+// be diffed and tracked by scripts. Progress and diagnostics go to stderr.
+
+namespace bench {
+
+struct Options {
+  // Number of primitives of the synthetic scenes
+  int64_t size = 1 << 20;
+  // Number of rays per traversal measurement
+  int64_t rays = 1 << 20;
+  uint32_t seed = 7;
+};
+
+using BenchFunc = std::function<void(const Options &)>;
+
+struct Registrar {
+  Registrar(const char *name, BenchFunc func);
+};
+
+// One JSON line with the benchmark name followed by the given fields
+class Report {
+public:
+  explicit Report(const std::string &bench);
+  ~Report();
+  Report &add(const char *key, double value);
+  Report &add(const char *key, int64_t value);
+  Report &add(const char *key, const std::string &value);
+
+private:
+  std::string line;
+};
+
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Func>
+double timeSeconds(Func &&func) {
+  auto start = std::chrono::steady_clock::now();
+  func();
+  return secondsSince(start);
+}
+
+}  // namespace bench
+
+#define BENCH_REGISTER(name, func) static bench::Registrar benchRegistrar_##func(name, func)
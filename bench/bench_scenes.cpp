@@ -0,0 +1,106 @@
+#include "bench_scenes.h"
+
+#include <cfloat>
+#include <cmath>
+#include <random>
+
+namespace bench {
+
+sPtr<TriangleMesh> makeBumpySphere(int64_t nTriangles, uint32_t seed) {
+  // nu * nv quads of two triangles with nu = 2 nv
+  int nv = std::max(2, static_cast<int>(std::sqrt(nTriangles / 4.0)));
+  int nu = 2 * nv;
+  std::mt19937 rng(seed);
+  // Up to a quarter of the edge length, enough to break the regularity
+  // without folding the surface
+  float amplitude = 0.25f * M_PI / nv;
+  std::uniform_real_distribution<float> bump(1.f - amplitude, 1.f + amplitude);
+  std::vector<vec3> p;
+  p.reserve((nu + 1) * (nv + 1));
+  for (int j = 0; j <= nv; ++j) {
+    for (int i = 0; i <= nu; ++i) {
+      float theta = M_PI * j / nv, phi = 2 * M_PI * i / nu;
+      vec3 d(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+      p.push_back(d * bump(rng));
+    }
+  }
+  std::vector<uint32_t> indices;
+  indices.reserve(6 * nu * nv);
+  for (int j = 0; j < nv; ++j) {
+    for (int i = 0; i < nu; ++i) {
+      uint32_t a = j * (nu + 1) + i, b = a + 1, c = a + nu + 1, d = c + 1;
+      indices.insert(indices.end(), {a, b, d, a, d, c});
+    }
+  }
+  return mkS<TriangleMesh>(std::move(p), std::move(indices), nullptr);
+}
+
+std::vector<Ray> makeCoherentRays(const aabb &bounds, int64_t count) {
+  int res = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(count))));
+  vec3 center = bounds.getCentroid();
+  vec3 extent = bounds.max() - bounds.min();
+  float radius = 0.5f * extent.length();
+  vec3 origin = center - vec3(0, 0, 3 * radius);
+  std::vector<Ray> rays;
+  rays.reserve(static_cast<size_t>(res) * res);
+  for (int y = 0; y < res; ++y) {
+    for (int x = 0; x < res; ++x) {
+      vec3 target = center + vec3(radius * (2.f * (x + 0.5f) / res - 1.f),
+                                  radius * (2.f * (y + 0.5f) / res - 1.f), 0.f);
+      rays.emplace_back(origin, unit_vector(target - origin));
+    }
+  }
+  return rays;
+}
+
+std::vector<Ray> makeIncoherentRays(const aabb &bounds, int64_t count, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+  vec3 lo = bounds.min(), extent = bounds.max() - bounds.min();
+  std::vector<Ray> rays;
+  rays.reserve(count);
+  for (int64_t i = 0; i < count; ++i) {
+    // Inner half of the bounds so most rays start inside the object
+    vec3 o = lo + extent * vec3(0.25f + 0.5f * u(rng), 0.25f + 0.5f * u(rng),
+                                0.25f + 0.5f * u(rng));
+    float z = 1.f - 2.f * u(rng), phi = 2.f * M_PI * u(rng);
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    rays.emplace_back(o, vec3(r * std::cos(phi), r * std::sin(phi), z));
+  }
+  return rays;
+}
+
+std::vector<Ray> makeAimedRays(const aabb &bounds, int64_t count, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+  vec3 center = bounds.getCentroid(), extent = bounds.max() - bounds.min();
+  float radius = 2.f * extent.length();
+  std::vector<Ray> rays;
+  rays.reserve(count);
+  for (int64_t i = 0; i < count; ++i) {
+    float z = 1.f - 2.f * u(rng), phi = 2.f * M_PI * u(rng);
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    vec3 o = center + radius * vec3(r * std::cos(phi), r * std::sin(phi), z);
+    vec3 target = center + extent * vec3(u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f) * 2.f;
+    rays.emplace_back(o, unit_vector(target - o), u(rng));
+  }
+  return rays;
+}
+
+RaySets makeRaySets(const aabb &bounds, int64_t count, uint32_t seed) {
+  RaySets sets;
+  sets.coherent = makeCoherentRays(bounds, count);
+  sets.incoherent = makeIncoherentRays(bounds, count, seed);
+  return sets;
+}
+
+int64_t traceAll(const Hitable &hitable, const std::vector<Ray> &rays) {
+  int64_t hits = 0;
+  for (const Ray &r : rays) {
+    HitRecord rec;
+    hits += hitable.hit(r, 0.001f, FLT_MAX, rec);
+  }
+  return hits;
+}
+
+}  // namespace bench
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ray.h"
+#include "smartpointerhelp.h"
+#include "triangle.h"
+
+// Synthetic inputs shared by the benchmarks, all deterministic for a seed
+
+namespace bench {
+
+// Closed unit sphere tessellated into about nTriangles triangles, with the
+// vertices pushed in and out randomly so the BVH sees uneven, overlapping
+// triangles rather than a perfectly regular grid
+sPtr<TriangleMesh> makeBumpySphere(int64_t nTriangles, uint32_t seed);
+
+// Pinhole camera rays from outside the scene bounds, neighbouring rays
+// traverse nearly the same nodes
+std::vector<Ray> makeCoherentRays(const aabb &bounds, int64_t count);
+// Random origins inside the scene bounds and random directions, like
+// secondary bounces
+std::vector<Ray> makeIncoherentRays(const aabb &bounds, int64_t count, uint32_t seed);
+// Rays from a sphere around the bounds aimed at random points of the bounds
+// grown to twice their size, so a good part of them miss the object inside.
+// Ray times are uniform in [0, 1).
+std::vector<Ray> makeAimedRays(const aabb &bounds, int64_t count, uint32_t seed);
+
+// The coherent and incoherent sets above over the same bounds, so the
+// traversal benchmarks compare their variants on identical rays
+struct RaySets {
+  std::vector<Ray> coherent, incoherent;
+};
+RaySets makeRaySets(const aabb &bounds, int64_t count, uint32_t seed);
+
+// Closest hit of every ray on one thread, returns the number of rays that hit
+int64_t traceAll(const Hitable &hitable, const std::vector<Ray> &rays);
+
+}  // namespace bench
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <iostream>
+
+#include "accelerators/bvh.h"
+#include "bench.h"
+#include "bench_scenes.h"
+
+// Build time, tree quality and traversal speed of the equal counts and the
+// SAH split over meshes growing tenfold from 1k triangles up to --size.
+// Builds and traversal both run on a single thread, traversal with at most
+// --rays coherent and incoherent rays.
+
+namespace {
+
+void benchBVHBuild(const bench::Options &options) {
+  const SplitMethod splits[] = {SplitMethod::EqualCounts, SplitMethod::SAH};
+  const char *names[] = {"equal_counts", "sah"};
+  for (int64_t size = 1000; size <= std::max<int64_t>(options.size, 1000); size *= 10) {
+    sPtr<TriangleMesh> mesh = bench::makeBumpySphere(size, options.seed);
+    bench::RaySets rays;
+    for (int s = 0; s < 2; ++s) {
+      uPtr<BVH> bvh;
+      double buildTime = bench::timeSeconds([&] { bvh.reset(new BVH(mesh, splits[s])); });
+      if (rays.coherent.empty()) {
+        aabb bounds;
+        bvh->bounding_box(0, 0, bounds);
+        rays = bench::makeRaySets(bounds, options.rays, options.seed);
+      }
+      BVHQuality quality = bvh->getQuality();
+      int64_t coherentHits = 0, incoherentHits = 0;
+      double coherentTime =
+          bench::timeSeconds([&] { coherentHits = bench::traceAll(*bvh, rays.coherent); });
+      double incoherentTime =
+          bench::timeSeconds([&] { incoherentHits = bench::traceAll(*bvh, rays.incoherent); });
+      bench::Report("bvh_build")
+          .add("split", std::string(names[s]))
+          .add("triangles", static_cast<int64_t>(mesh->numTriangles()))
+          .add("build_s", buildTime)
+          .add("mtris_s", mesh->numTriangles() / buildTime * 1e-6)
+          .add("node_bytes", static_cast<int64_t>(bvh->getNodeBytes()))
+          .add("max_depth", static_cast<int64_t>(quality.maxDepth))
+          .add("sah_cost", static_cast<double>(quality.sahCost))
+          .add("mean_overlap", static_cast<double>(quality.meanOverlap))
+          .add("coherent_mrays_s", rays.coherent.size() / coherentTime * 1e-6)
+          .add("coherent_hits", coherentHits)
+          .add("incoherent_mrays_s", rays.incoherent.size() / incoherentTime * 1e-6)
+          .add("incoherent_hits", incoherentHits);
+    }
+  }
+}
+
+}  // namespace
+
+BENCH_REGISTER("bvh_build", benchBVHBuild);
@@ -0,0 +1,49 @@
+#include <iostream>
+
+#include "accelerators/bvh.h"
+#include "bench.h"
+#include "bench_scenes.h"
+
+// Memory versus traversal speed of the full precision and the compressed BVH
+// node layouts over the same mesh and the same rays. Rays/s are measured on a
+// single thread.
+
+namespace {
+
+void benchBVHLayout(const bench::Options &options) {
+  sPtr<TriangleMesh> mesh = bench::makeBumpySphere(options.size, options.seed);
+  const BVHLayout layouts[] = {BVHLayout::Full, BVHLayout::Compressed};
+  const char *names[] = {"full", "compressed"};
+  bench::RaySets rays;
+  for (int l = 0; l < 2; ++l) {
+    uPtr<BVH> bvh;
+    double buildTime = bench::timeSeconds(
+        [&] { bvh.reset(new BVH(mesh, SplitMethod::SAH, layouts[l])); });
+    if (rays.coherent.empty()) {
+      aabb bounds;
+      bvh->bounding_box(0, 0, bounds);
+      rays = bench::makeRaySets(bounds, options.rays, options.seed);
+    }
+    int64_t coherentHits = 0, incoherentHits = 0;
+    double coherentTime =
+        bench::timeSeconds([&] { coherentHits = bench::traceAll(*bvh, rays.coherent); });
+    double incoherentTime =
+        bench::timeSeconds([&] { incoherentHits = bench::traceAll(*bvh, rays.incoherent); });
+    bench::Report("bvh_layout")
+        .add("layout", std::string(names[l]))
+        .add("triangles", static_cast<int64_t>(mesh->numTriangles()))
+        .add("node_bytes", static_cast<int64_t>(bvh->getNodeBytes()))
+        .add("nodes", static_cast<int64_t>(bvh->getQuality().nodes))
+        .add("sah_cost", static_cast<double>(bvh->getQuality().sahCost))
+        .add("bytes_per_triangle", static_cast<double>(bvh->getNodeBytes()) / mesh->numTriangles())
+        .add("build_s", buildTime)
+        .add("coherent_mrays_s", rays.coherent.size() / coherentTime * 1e-6)
+        .add("coherent_hits", coherentHits)
+        .add("incoherent_mrays_s", rays.incoherent.size() / incoherentTime * 1e-6)
+        .add("incoherent_hits", incoherentHits);
+  }
+}
+
+}  // namespace
+
+BENCH_REGISTER("bvh_layout", benchBVHLayout);
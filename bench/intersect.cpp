@@ -0,0 +1,79 @@
+#include <array>
+#include <iostream>
+
+#include "aabb.h"
+#include "bench.h"
+#include "bench_scenes.h"
+#include "box.h"
+#include "rect.h"
+#include "sphere.h"
+
+// Single ray intersection kernels of the analytic shapes and the slab test of
+// the bounding boxes. Every kernel gets the same number of rays aimed at its
+// bounds, many of them missing, and is called through Hitable like the
+// renderer does. Times are on a single thread.
+
+namespace {
+
+template <typename Func>
+void report(const char *shape, const std::vector<Ray> &rays, Func &&hit) {
+  int64_t hits = 0;
+  // One untimed pass so the first kernel does not pay for cold caches
+  for (const Ray &r : rays) hits += hit(r);
+  hits = 0;
+  double seconds = bench::timeSeconds([&] {
+    for (const Ray &r : rays) hits += hit(r);
+  });
+  bench::Report("intersect")
+      .add("shape", std::string(shape))
+      .add("rays", static_cast<int64_t>(rays.size()))
+      .add("ns_per_ray", seconds / rays.size() * 1e9)
+      .add("mrays_s", rays.size() / seconds * 1e-6)
+      .add("hit_rate", static_cast<double>(hits) / rays.size());
+}
+
+void reportHitable(const char *shape, const Hitable &hitable, const bench::Options &options) {
+  aabb bounds;
+  hitable.bounding_box(0, 1, bounds);
+  std::vector<Ray> rays = bench::makeAimedRays(bounds, options.rays, options.seed);
+  report(shape, rays, [&](const Ray &r) {
+    HitRecord rec;
+    return hitable.hit(r, 0.001f, FLT_MAX, rec);
+  });
+}
+
+void benchIntersect(const bench::Options &options) {
+  reportHitable("sphere", sphere(vec3(0.f), 1.f, nullptr), options);
+  reportHitable("moving_sphere",
+                moving_sphere(vec3(-0.5f, 0.f, 0.f), vec3(0.5f, 0.f, 0.f), 0.f, 1.f, 1.f, nullptr),
+                options);
+  reportHitable("xy_rect", xy_rect(-1.f, 1.f, -1.f, 1.f, 0.f, nullptr), options);
+  reportHitable("xz_rect", xz_rect(-1.f, 1.f, -1.f, 1.f, 0.f, nullptr), options);
+  reportHitable("yz_rect", yz_rect(-1.f, 1.f, -1.f, 1.f, 0.f, nullptr), options);
+  reportHitable("box", box(vec3(-1.f), vec3(1.f), nullptr), options);
+
+  aabb bounds(vec3(-1.f), vec3(1.f));
+  std::vector<Ray> rays = bench::makeAimedRays(bounds, options.rays, options.seed);
+  report("aabb", rays, [&](const Ray &r) { return bounds.hit(r, 0.001f, FLT_MAX); });
+  // As the BVH calls it, with the reciprocal direction and signs computed
+  // once per ray and not per box
+  std::vector<vec3> invDirs;
+  std::vector<std::array<int, 3>> dirIsNeg;
+  invDirs.reserve(rays.size());
+  dirIsNeg.reserve(rays.size());
+  for (const Ray &r : rays) {
+    vec3 inv(1.f / r.B.x(), 1.f / r.B.y(), 1.f / r.B.z());
+    invDirs.push_back(inv);
+    dirIsNeg.push_back({inv.x() < 0, inv.y() < 0, inv.z() < 0});
+  }
+  size_t i = 0;
+  report("aabb_precomputed", rays, [&](const Ray &r) {
+    size_t k = i;
+    i = i + 1 == rays.size() ? 0 : i + 1;
+    return bounds.hit(r, invDirs[k], dirIsNeg[k].data(), 0.001f, FLT_MAX);
+  });
+}
+
+}  // namespace
+
+BENCH_REGISTER("intersect", benchIntersect);
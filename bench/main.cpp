@@ -0,0 +1,84 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#include "bench.h"
+#include "core/parallel.h"
+
+namespace bench {
+
+static std::map<std::string, BenchFunc> &registry() {
+  static std::map<std::string, BenchFunc> benches;
+  return benches;
+}
+
+Registrar::Registrar(const char *name, BenchFunc func) { registry()[name] = std::move(func); }
+
+Report::Report(const std::string &bench) : line("{\"bench\": \"" + bench + "\"") {}
+
+Report::~Report() {
+  line += "}";
+  std::printf("%s\n", line.c_str());
+  std::fflush(stdout);
+}
+
+Report &Report::add(const char *key, double value) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "%.6g", value);
+  line += std::string(", \"") + key + "\": " + buf;
+  return *this;
+}
+
+Report &Report::add(const char *key, int64_t value) {
+  line += std::string(", \"") + key + "\": " + std::to_string(value);
+  return *this;
+}
+
+Report &Report::add(const char *key, const std::string &value) {
+  line += std::string(", \"") + key + "\": \"" + value + "\"";
+  return *this;
+}
+
+}  // namespace bench
+
+static void usage() {
+  std::cerr << "Usage: RayTracerBench [--size N] [--rays N] [--seed N] [--list] [name...]"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  bench::Options options;
+  std::vector<std::string> filters;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "--list")) {
+      for (auto &b : bench::registry()) std::cout << b.first << std::endl;
+      return 0;
+    } else if (!std::strcmp(argv[i], "--size") && i + 1 < argc) {
+      options.size = std::atoll(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--rays") && i + 1 < argc) {
+      options.rays = std::atoll(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--seed") && i + 1 < argc) {
+      options.seed = std::atoi(argv[++i]);
+    } else if (argv[i][0] == '-') {
+      usage();
+      return 1;
+    } else {
+      filters.push_back(argv[i]);
+    }
+  }
+
+  raytracer::parallelInit();
+  // Names given on the command line select benchmarks by substring
+  for (auto &b : bench::registry()) {
+    bool selected = filters.empty();
+    for (auto &f : filters) selected = selected || b.first.find(f) != std::string::npos;
+    if (selected) {
+      std::cerr << "Running " << b.first << std::endl;
+      b.second(options);
+    }
+  }
+  raytracer::parallelClean();
+  return 0;
+}
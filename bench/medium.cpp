@@ -0,0 +1,86 @@
+#include <cmath>
+#include <random>
+
+#include "bench.h"
+#include "medium.h"
+
+// Rays across a grid_medium holding a few clouds of noise in an otherwise
+// empty box, with majorants over bricks of several sizes. A single brick
+// covering the grid is delta tracking against one global majorant. escaped
+// is the fraction of rays without a collision from hit(), transmittance the
+// mean ratio tracking estimate over the same rays; both estimate the same
+// value and should not depend on the brick size. Times are on a single
+// thread.
+
+namespace {
+
+const int kResolution = 128;
+const float kSize = 100.f;
+
+std::vector<float> cloudDensities() {
+  perlin noise;
+  const vec3 centers[] = {vec3(25, 30, 70), vec3(70, 60, 30), vec3(60, 20, 75)};
+  std::vector<float> densities(size_t(kResolution) * kResolution * kResolution);
+  for (int z = 0; z < kResolution; ++z) {
+    for (int y = 0; y < kResolution; ++y) {
+      for (int x = 0; x < kResolution; ++x) {
+        vec3 p = (vec3(x, y, z) + vec3(0.5f)) * (kSize / kResolution);
+        float density = 0.f;
+        for (const vec3 &c : centers) {
+          float r = (p - c).length() / 18.f;
+          density += r < 1.f ? (1.f - r) * 4.f * noise.turb(p * 0.1f) : 0.f;
+        }
+        densities[(size_t(z) * kResolution + y) * kResolution + x] = density;
+      }
+    }
+  }
+  return densities;
+}
+
+void benchMedium(const bench::Options &options) {
+  std::vector<float> densities = cloudDensities();
+  aabb bounds(vec3(0.f), vec3(kSize));
+  texture *white = new constant_texture(vec3(1.f));
+
+  // From one face of the box to a random point of the opposite one
+  std::mt19937 rng(options.seed);
+  std::uniform_real_distribution<float> u(0.f, kSize);
+  std::vector<Ray> rays;
+  rays.reserve(options.rays);
+  for (int64_t i = 0; i < options.rays; ++i) {
+    int axis = i % 3;
+    vec3 from(u(rng), u(rng), u(rng)), to(u(rng), u(rng), u(rng));
+    from.e[axis] = -1.f;
+    to.e[axis] = kSize + 1.f;
+    rays.emplace_back(from, to - from);
+  }
+
+  double baseline = 0.0;
+  for (int brick : {kResolution, 16, 8, 4}) {
+    grid_medium medium(bounds, kResolution, kResolution, kResolution, densities, 0.5f, white,
+                       brick);
+    int64_t escaped = 0;
+    double ns = bench::timeSeconds([&] {
+      HitRecord rec;
+      for (const Ray &r : rays) escaped += !medium.hit(r, 0.001f, FLT_MAX, rec);
+    }) / rays.size() * 1e9;
+    double transmittance = 0.0;
+    for (const Ray &r : rays) transmittance += medium.transmittance(r, 0.001f, FLT_MAX);
+    if (brick == kResolution) {
+      baseline = ns;
+    }
+    bench::Report("medium")
+        .add("brick", static_cast<int64_t>(brick))
+        .add("rays", static_cast<int64_t>(rays.size()))
+        .add("ns_per_ray", ns)
+        .add("speedup", baseline / ns)
+        .add("stored_bricks", static_cast<int64_t>(medium.storedBricks()))
+        .add("total_bricks", static_cast<int64_t>(medium.totalBricks()))
+        .add("escaped", static_cast<double>(escaped) / rays.size())
+        .add("transmittance", transmittance / rays.size());
+  }
+}
+
+}  // namespace
+
+BENCH_REGISTER("medium", benchMedium);
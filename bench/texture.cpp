@@ -0,0 +1,72 @@
+#include <random>
+
+#include "bench.h"
+#include "texture.h"
+
+// Texture lookups at random points, one virtual value() call per lookup as
+// the materials make them, against values() over batches of 64 lookups as a
+// group of rays sharing a material would. Times are on a single thread;
+// match is 1 when both give the same colors.
+
+namespace {
+
+const int kBatchSize = 64;
+
+void reportTexture(const char *name, const texture &tex, const std::vector<float> &u,
+                   const std::vector<float> &v, const std::vector<vec3> &p) {
+  int64_t count = p.size();
+  std::vector<vec3> single(count), batched(count);
+  double singleSeconds = bench::timeSeconds([&] {
+    for (int64_t i = 0; i < count; ++i) single[i] = tex.value(u[i], v[i], p[i]);
+  });
+  double batchSeconds = bench::timeSeconds([&] {
+    for (int64_t i = 0; i < count; i += kBatchSize) {
+      TextureBatch batch;
+      batch.count = std::min<int64_t>(kBatchSize, count - i);
+      batch.u = &u[i];
+      batch.v = &v[i];
+      batch.p = &p[i];
+      tex.values(batch, &batched[i]);
+    }
+  });
+  bool match = true;
+  for (int64_t i = 0; i < count; ++i) {
+    match = match && single[i].x() == batched[i].x() && single[i].y() == batched[i].y() &&
+            single[i].z() == batched[i].z();
+  }
+  bench::Report("texture")
+      .add("texture", std::string(name))
+      .add("lookups", count)
+      .add("single_ns", singleSeconds / count * 1e9)
+      .add("batch_ns", batchSeconds / count * 1e9)
+      .add("speedup", singleSeconds / batchSeconds)
+      .add("match", static_cast<int64_t>(match));
+}
+
+void benchTexture(const bench::Options &options) {
+  std::mt19937 rng(options.seed);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  int64_t count = options.rays;
+  std::vector<float> u(count), v(count);
+  std::vector<vec3> p(count);
+  for (int64_t i = 0; i < count; ++i) {
+    u[i] = unit(rng);
+    v[i] = unit(rng);
+    p[i] = 4.f * vec3(unit(rng), unit(rng), unit(rng));
+  }
+
+  constant_texture green(vec3(0.2f, 0.3f, 0.1f)), white(vec3(0.9f));
+  reportTexture("constant", green, u, v, p);
+  reportTexture("checker", checker_texture(&green, &white), u, v, p);
+  noise_texture noise(4.f);
+  reportTexture("noise", noise, u, v, p);
+  reportTexture("checker_noise", checker_texture(&noise, &white), u, v, p);
+  const int size = 512;
+  std::vector<unsigned char> pixels(size * size * 3);
+  for (unsigned char &c : pixels) c = rng() & 255;
+  reportTexture("image", image_texture(pixels.data(), size, size), u, v, p);
+}
+
+}  // namespace
+
+BENCH_REGISTER("texture", benchTexture);
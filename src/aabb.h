@@ -14,7 +14,7 @@ class aabb {
   vec3 _min, _max;
 
  public:
-  aabb() : _min(FLT_MAX), _max(FLT_MIN) {}
+  aabb() : _min(FLT_MAX), _max(-FLT_MAX) {}
   aabb(const vec3& a, const vec3& b) {
     _min = a;
     _max = b;
@@ -35,6 +35,15 @@ class aabb {
     _min = Min(_min, box.min());
   }
 
+  bool contains(const aabb &box) const {
+    for (int a = 0; a < 3; ++a) {
+      if (box._min[a] < _min[a] || box._max[a] > _max[a]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   float getSurfaceArea() const {
     float sideX = _max[0] - _min[0],
           sideY = _max[1] - _min[1],
@@ -44,8 +53,8 @@ class aabb {
 
   // Return the max extent axis
   int getMaxExtentAxis() {
-    int axis = -1;
-    float maxExtent = FLT_MIN;
+    int axis = 0;
+    float maxExtent = -FLT_MAX;
     for (int i = 0; i < 3; ++i) {
       if (_max[i] - _min[i] > maxExtent) {
         maxExtent = _max[i] - _min[i];
@@ -72,6 +81,21 @@ class aabb {
     }
     return true;
   }
+
+  // Same slab test with the reciprocal direction computed once per ray
+  bool hit(const Ray& r, const vec3& invDir, const int dirIsNeg[3], float tmin,
+           float tmax) const {
+    for (int a = 0; a < 3; a++) {
+      float t0 = ((dirIsNeg[a] ? _max : _min)[a] - r.A[a]) * invDir[a];
+      float t1 = ((dirIsNeg[a] ? _min : _max)[a] - r.A[a]) * invDir[a];
+      tmin = ffmax(t0, tmin);
+      tmax = ffmin(t1, tmax);
+      if (tmax <= tmin) {
+        return false;
+      }
+    }
+    return true;
+  }
 };
 
 inline aabb surrounding_box(const aabb &box0, const aabb &box1) {
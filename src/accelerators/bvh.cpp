@@ -1,108 +1,47 @@
 #include "accelerators/bvh.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 
-bool BVHNode::hit(const Ray &r, float tMin, float tMax, HitRecord &rec) const {
-  if (!box.hit(r, tMin, tMax)) {
-    return false;
-  }
-  if (!left && !right) {
-    // Indicate this is a leaf node
-    float tMinHit = FLT_MAX;
-    HitRecord minRec;
-    bool hitAnything = false;
-    std::vector<sPtr<Hitable>> &hitables = accelerator->hitables;
-    for (int i = start; i < start + nPrimitives; ++i) {
-      if (hitables[i]->hit(r, tMin, tMax, minRec)) {
-        hitAnything = true;
-        if (minRec.t < tMinHit) {
-          rec = minRec;
-          tMinHit = minRec.t;
-        }
-      }
-    }
-    return hitAnything;
-  }
-
-  HitRecord leftRec, rightRec;
-  bool hitLeft = left->hit(r, tMin, tMax, leftRec);
-  bool hitRight = right->hit(r, tMin, tMax, rightRec);
-  // If hit both left and right, record the first hit
-  if (hitLeft && hitRight) {
-    rec = leftRec.t < rightRec.t ? leftRec : rightRec;
-    return true;
-  } else if (hitLeft || hitRight) {
-    rec = hitLeft ? leftRec : rightRec;
-    return true;
-  }
-  return false;
-}
-
-bool box_x_compare(const sPtr<Hitable> &a, const sPtr<Hitable> &b) {
-  aabb box_left, box_right;
-  if (!a->bounding_box(0, 0, box_left) || !b->bounding_box(0, 0, box_right)) {
-    std::cerr << "no bounding box in bvh_node constructor" << std::endl;
-  }
-  return box_left.min().x() < box_right.min().x();
-}
-
-bool box_y_compare(const sPtr<Hitable> &a, const sPtr<Hitable> &b) {
-  aabb box_left, box_right;
-  if (!a->bounding_box(0, 0, box_left) || !b->bounding_box(0, 0, box_right)) {
-    std::cerr << "no bounding box in bvh_node constructor" << std::endl;
-  }
-  return box_left.min().y() < box_right.min().y();
-}
+#include "core/perf_counters.h"
+#include "core/stats.h"
 
-bool box_z_compare(const sPtr<Hitable> &a, const sPtr<Hitable> &b) {
-  aabb box_left, box_right;
-  if (!a->bounding_box(0, 0, box_left) || !b->bounding_box(0, 0, box_right)) {
-    std::cerr << "no bounding box in bvh_node constructor" << std::endl;
-  }
-  return box_left.min().z() < box_right.min().z();
-}
+// Leaves store their primitive count in 16 bits, stay well below that
+static const int maxPrimsInLeaf = 255;
 
 void BVH::buildLeaf(BVHNode *node, int start, int end) {
   node->start = start;
   node->nPrimitives = end - start;
-  aabb tempBox;
   for (int i = start; i < end; ++i) {
-    hitables[i]->bounding_box(tMin, tMax, tempBox);
-    node->box = surrounding_box(tempBox, node->box);
+    node->box = surrounding_box(primInfo[i].bounds, node->box);
   }
 }
 
 void BVH::buildEqualCounts(BVHNode *node, int start, int end) {
-  // If we only has one object, we duplicate it on both sides
   int n = end - start;
-  node->left = mkU<BVHNode>(this);
-  node->right = mkU<BVHNode>(this);
   if (n == 1) {
-    buildLeaf(node->left.get(), start, end);
-    buildLeaf(node->right.get(), start, end);
-    node->box = surrounding_box(node->left->box, node->right->box);
+    buildLeaf(node, start, end);
     return;
   }
 
-  aabb centerBox, tempBox;
-  // TODO: Reduce the number of passes through the hitables
-  // Currently the parent will loop over all the child nodes
+  aabb centerBox;
   for (int i = start; i < end; i++) {
-    hitables[i]->bounding_box(tMin, tMax, tempBox);
-    centerBox = surrounding_box(centerBox, tempBox.getCentroid());
+    centerBox = surrounding_box(centerBox, primInfo[i].centroid);
   }
-
   int axis = centerBox.getMaxExtentAxis();
 
-  if (axis == 0) {
-    std::sort(hitables.begin() + start, hitables.begin() + end, box_x_compare);
-  } else if (axis == 1) {
-    std::sort(hitables.begin() + start, hitables.begin() + end, box_y_compare);
-  } else {
-    std::sort(hitables.begin() + start, hitables.begin() + end, box_z_compare);
-  }
-
+  // Only the median has to be in place, no need for a full sort
   int mid = start + (end - start) / 2;
+  std::nth_element(primInfo.begin() + start, primInfo.begin() + mid, primInfo.begin() + end,
+                   [axis](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b) {
+                     return a.centroid[axis] < b.centroid[axis];
+                   });
+
+  node->axis = axis;
+  node->left = mkU<BVHNode>();
+  node->right = mkU<BVHNode>();
+  totalNodes += 2;
   buildEqualCounts(node->left.get(), start, mid);
   buildEqualCounts(node->right.get(), mid, end);
 
@@ -110,25 +49,16 @@ void BVH::buildEqualCounts(BVHNode *node, int start, int end) {
 }
 
 void BVH::buildSAH(BVHNode *node, int start, int end) {
-  // If we only has one object, we duplicate it on both sides
   int n = end - start;
   if (n == 1) {
-    node->left = mkU<BVHNode>(this);
-    node->right = mkU<BVHNode>(this);
-    buildLeaf(node->left.get(), start, end);
-    buildLeaf(node->right.get(), start, end);
-    node->box = surrounding_box(node->left->box, node->right->box);
+    buildLeaf(node, start, end);
     return;
   }
 
   aabb centerBox, totalBox;
-  aabb hitableBounds[end - start];
-  // TODO: Reduce the number of passes through the hitables
-  // Currently the parent will loop over all the child nodes
   for (int i = start; i < end; i++) {
-    hitables[i]->bounding_box(tMin, tMax, hitableBounds[i - start]);
-    totalBox = surrounding_box(totalBox, hitableBounds[i - start]);
-    centerBox = surrounding_box(centerBox, hitableBounds[i - start].getCentroid());
+    totalBox = surrounding_box(totalBox, primInfo[i].bounds);
+    centerBox = surrounding_box(centerBox, primInfo[i].centroid);
   }
 
   int axis = centerBox.getMaxExtentAxis();
@@ -140,102 +70,512 @@ void BVH::buildSAH(BVHNode *node, int start, int end) {
     return;
   }
 
-  int numOfBuckets = 12;
+  const int numOfBuckets = 12;
   struct BucketInfo {
     aabb bound;
     size_t count = 0;
   };
   BucketInfo buckets[numOfBuckets];
-  for (int i = start; i < end; i++) {
-    vec3 center = hitableBounds[i - start].getCentroid();
+  auto getBucket = [&](const BVHPrimitiveInfo &info) {
     // Calculate the relative offset from 0 to 1
-    float offset = (center[axis] - axisMin) / (axisMax - axisMin);
-    int bucketIdx = offset * numOfBuckets;
-    buckets[bucketIdx].bound = surrounding_box(buckets[bucketIdx].bound, hitableBounds[i - start]);
+    float offset = (info.centroid[axis] - axisMin) / (axisMax - axisMin);
+    return std::min(static_cast<int>(offset * numOfBuckets), numOfBuckets - 1);
+  };
+  for (int i = start; i < end; i++) {
+    int bucketIdx = getBucket(primInfo[i]);
+    buckets[bucketIdx].bound = surrounding_box(buckets[bucketIdx].bound, primInfo[i].bounds);
     buckets[bucketIdx].count++;
   }
-  // There are numOfBuckets - 1 ways to split the buckets into two piles
-  float cost[numOfBuckets - 1];
-  // TODO: This loop can be optimized to O(N)
-  for (size_t i = 1; i < numOfBuckets; i++) {
-    int leftCount = 0, rightCount = 0;
-    aabb leftBound, rightBound;
-    for (size_t j = 0; j < i; j++) {
-      leftCount += buckets[j].count;
-      leftBound = surrounding_box(leftBound, buckets[j].bound);
-    }
-    for (size_t j = i; j < numOfBuckets; j++) {
-      rightCount += buckets[j].count;
-      rightBound = surrounding_box(rightBound, buckets[j].bound);
+
+  // There are numOfBuckets - 1 ways to split the buckets into two piles,
+  // sweep once from each side to get the bounds of both piles
+  float leftArea[numOfBuckets - 1];
+  int leftCount[numOfBuckets - 1];
+  aabb sweepBound;
+  int sweepCount = 0;
+  for (int i = 0; i < numOfBuckets - 1; i++) {
+    if (buckets[i].count > 0) {
+      sweepBound = surrounding_box(sweepBound, buckets[i].bound);
+      sweepCount += buckets[i].count;
     }
-    cost[i - 1] =
-        1.f + (leftBound.getSurfaceArea() * leftCount + rightBound.getSurfaceArea() * rightCount) /
-                  totalBox.getSurfaceArea();
+    leftArea[i] = sweepCount > 0 ? sweepBound.getSurfaceArea() : 0.f;
+    leftCount[i] = sweepCount;
   }
   float minCost = FLT_MAX;
   int minBucketSplit = -1;
-  // Find the min bucket split pos
-  for (size_t i = 0; i < numOfBuckets - 1; ++i) {
-    if (cost[i] < minCost) {
-      minCost = cost[i];
-      minBucketSplit = i + 1;
+  sweepBound = aabb();
+  sweepCount = 0;
+  for (int i = numOfBuckets - 1; i > 0; i--) {
+    if (buckets[i].count > 0) {
+      sweepBound = surrounding_box(sweepBound, buckets[i].bound);
+      sweepCount += buckets[i].count;
+    }
+    float rightArea = sweepCount > 0 ? sweepBound.getSurfaceArea() : 0.f;
+    float cost = 1.f + (leftArea[i - 1] * leftCount[i - 1] + rightArea * sweepCount) /
+                           totalBox.getSurfaceArea();
+    if (cost < minCost) {
+      minCost = cost;
+      minBucketSplit = i;
     }
   }
   // The cost for initialize all hitables to a leaf node is equal to the number of hitables
   float leafCost = end - start;
-  if (leafCost < minCost) {
+  if (leafCost < minCost && n <= maxPrimsInLeaf) {
     buildLeaf(node, start, end);
     return;
   }
   // Split the array
-  float splitBound = axisMin + static_cast<float>(minBucketSplit) / numOfBuckets * (axisMax - axisMin);
-  auto midItr =
-      std::partition(hitables.begin() + start, hitables.begin() + end, [&](const sPtr<Hitable> &h) {
-        aabb bound;
-        h->bounding_box(tMin, tMax, bound);
-        return bound.getCentroid()[axis] < splitBound;
-      });
-  int mid = midItr - hitables.begin();
-  node->left = mkU<BVHNode>(this);
-  node->right = mkU<BVHNode>(this);
+  auto midItr = std::partition(
+      primInfo.begin() + start, primInfo.begin() + end,
+      [&](const BVHPrimitiveInfo &info) { return getBucket(info) < minBucketSplit; });
+  int mid = midItr - primInfo.begin();
+  if (mid == start || mid == end) {
+    buildEqualCounts(node, start, end);
+    return;
+  }
+  node->axis = axis;
+  node->left = mkU<BVHNode>();
+  node->right = mkU<BVHNode>();
+  totalNodes += 2;
   buildSAH(node->left.get(), start, mid);
   buildSAH(node->right.get(), mid, end);
   node->box = surrounding_box(node->right->box, node->left->box);
 }
 
 bool BVH::hit(const Ray &r, float tMin, float tMax, HitRecord &rec) const {
-  if (!root) {
+  if (layout == BVHLayout::Compressed) {
+    return hitCompressed(r, tMin, tMax, rec);
+  }
+  if (nodes.empty()) {
+    return false;
+  }
+  vec3 invDir(1.f / r.direction().x(), 1.f / r.direction().y(), 1.f / r.direction().z());
+  int dirIsNeg[3] = {invDir.x() < 0, invDir.y() < 0, invDir.z() < 0};
+  // Nodes still to visit, the near child is always visited first so that the
+  // range shrinks as early as possible
+  int toVisitOffset = 0, currentNodeIndex = 0;
+  int nodesToVisit[64];
+  bool hitAnything = false;
+  uint64_t nodesVisited = 0, primitivesTested = 0;
+  while (true) {
+    const LinearBVHNode &node = nodes[currentNodeIndex];
+    ++nodesVisited;
+    if (node.box.hit(r, invDir, dirIsNeg, tMin, tMax)) {
+      if (node.nPrimitives > 0) {
+        primitivesTested += node.nPrimitives;
+        for (int i = 0; i < node.nPrimitives; ++i) {
+          // The range shrinks with every hit, so any new hit is the closest so far
+          if (hitPrimitive(node.primitivesOffset + i, r, tMin, tMax, rec)) {
+            hitAnything = true;
+            tMax = rec.t;
+          }
+        }
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+      } else if (dirIsNeg[node.axis]) {
+        nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+        currentNodeIndex = node.secondChildOffset;
+      } else {
+        nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+        currentNodeIndex = currentNodeIndex + 1;
+      }
+    } else {
+      if (toVisitOffset == 0) break;
+      currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+  }
+  raytracer::RayStats &stats = raytracer::threadStats();
+  stats.nodesVisited += nodesVisited;
+  stats.primitivesTested += primitivesTested;
+  return hitAnything;
+}
+
+// 2^e for the exponent range of normalized floats, without going through ldexp
+static inline float exp2i(int e) {
+  uint32_t bits = static_cast<uint32_t>(e + 127) << 23;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// Decoded grid position, shared by the build and the traversal so the
+// conservative rounding checked during the build holds during traversal
+static inline float dequantize(float origin, float scale, uint8_t q) { return origin + q * scale; }
+
+bool BVH::hitCompressed(const Ray &r, float tMin, float tMax, HitRecord &rec) const {
+  if (compressedNodes.empty()) {
     return false;
   }
-  return root->hit(r, tMin, tMax, rec);
+  vec3 invDir(1.f / r.direction().x(), 1.f / r.direction().y(), 1.f / r.direction().z());
+  int dirIsNeg[3] = {invDir.x() < 0, invDir.y() < 0, invDir.z() < 0};
+  struct StackEntry {
+    uint32_t node;
+    float tNear;
+  };
+  StackEntry stack[256];
+  int stackSize = 0;
+  stack[stackSize++] = {0, tMin};
+  bool hitAnything = false;
+  // A visit tests the boxes of all children of the node
+  uint64_t nodesVisited = 0, primitivesTested = 0;
+  while (stackSize > 0) {
+    StackEntry entry = stack[--stackSize];
+    // The range may have shrunk since the node was pushed
+    if (entry.tNear > tMax) continue;
+    const CompressedBVHNode &node = compressedNodes[entry.node];
+    ++nodesVisited;
+
+    float scale[3];
+    for (int a = 0; a < 3; ++a) scale[a] = exp2i(node.exponent[a]);
+    // Children whose box is hit, sorted from near to far
+    float tNear[4];
+    int order[4], nHit = 0;
+    for (int c = 0; c < node.nChildren; ++c) {
+      float t0 = tMin, t1 = tMax;
+      for (int a = 0; a < 3; ++a) {
+        float lo = dequantize(node.origin[a], scale[a], node.qMin[a][c]);
+        float hi = dequantize(node.origin[a], scale[a], node.qMax[a][c]);
+        float tn = ((dirIsNeg[a] ? hi : lo) - r.A[a]) * invDir[a];
+        float tf = ((dirIsNeg[a] ? lo : hi) - r.A[a]) * invDir[a];
+        t0 = ffmax(tn, t0);
+        t1 = ffmin(tf, t1);
+      }
+      if (t0 <= t1) {
+        int k = nHit++;
+        for (; k > 0 && tNear[k - 1] > t0; --k) {
+          tNear[k] = tNear[k - 1];
+          order[k] = order[k - 1];
+        }
+        tNear[k] = t0;
+        order[k] = c;
+      }
+    }
+
+    // Leaves are intersected right away from near to far, interior children
+    // are pushed from far to near so the nearest one is popped first
+    for (int k = 0; k < nHit; ++k) {
+      int c = order[k];
+      if (node.nPrimitives[c] == 0 || tNear[k] > tMax) continue;
+      primitivesTested += node.nPrimitives[c];
+      for (int i = 0; i < node.nPrimitives[c]; ++i) {
+        if (hitPrimitive(node.child[c] + i, r, tMin, tMax, rec)) {
+          hitAnything = true;
+          tMax = rec.t;
+        }
+      }
+    }
+    for (int k = nHit - 1; k >= 0; --k) {
+      int c = order[k];
+      if (node.nPrimitives[c] == 0 && tNear[k] <= tMax) {
+        stack[stackSize++] = {node.child[c], tNear[k]};
+      }
+    }
+  }
+  raytracer::RayStats &stats = raytracer::threadStats();
+  stats.nodesVisited += nodesVisited;
+  stats.primitivesTested += primitivesTested;
+  return hitAnything;
 }
 
 bool BVH::bounding_box(float tMin, float tMax, aabb &box) const {
-  if (!root) {
+  if (nodes.empty() && compressedNodes.empty()) {
     return false;
   }
-  box = root->box;
+  box = bounds;
   return true;
 }
 
-BVH::BVH(std::vector<sPtr<Hitable>> hl, float tMin, float tMax, SplitMethod sp)
-    : hitables(std::move(hl)), splitMethod(sp), tMin(tMin), tMax(tMax), root(mkU<BVHNode>(this)) {
-  if (hitables.size() == 0) {
-    root.reset(nullptr);
+static float overlapArea(const aabb &a, const aabb &b) {
+  vec3 lo, hi;
+  for (int i = 0; i < 3; ++i) {
+    lo[i] = std::max(a.min()[i], b.min()[i]);
+    hi[i] = std::min(a.max()[i], b.max()[i]);
+    if (hi[i] < lo[i]) return 0.f;
+  }
+  return aabb(lo, hi).getSurfaceArea();
+}
+
+BVHQuality BVH::getQuality() const {
+  BVHQuality q;
+  float rootArea = bounds.getSurfaceArea();
+  if (rootArea <= 0.f || (nodes.empty() && compressedNodes.empty())) {
+    return q;
+  }
+  int interiorNodes = 0;
+  double overlapSum = 0.0;
+  auto addLeaf = [&](const aabb &box, int nPrimitives, int depth) {
+    ++q.leaves;
+    if (int(q.leafDepths.size()) <= depth) q.leafDepths.resize(depth + 1);
+    ++q.leafDepths[depth];
+    if (int(q.leafSizes.size()) <= nPrimitives) q.leafSizes.resize(nPrimitives + 1);
+    ++q.leafSizes[nPrimitives];
+    q.maxDepth = std::max(q.maxDepth, depth);
+    q.sahCost += box.getSurfaceArea() / rootArea * nPrimitives;
+  };
+  auto addInterior = [&](const aabb &box, const aabb *children, int nChildren) {
+    ++interiorNodes;
+    q.sahCost += box.getSurfaceArea() / rootArea;
+    float overlap = 0.f;
+    for (int i = 0; i < nChildren; ++i) {
+      for (int j = i + 1; j < nChildren; ++j) {
+        overlap += overlapArea(children[i], children[j]);
+      }
+    }
+    overlap = box.getSurfaceArea() > 0.f ? overlap / box.getSurfaceArea() : 0.f;
+    overlapSum += overlap;
+    q.maxOverlap = std::max(q.maxOverlap, overlap);
+  };
+
+  // Explicit stacks of (node, depth), trees can be deeper than the call stack
+  if (layout == BVHLayout::Compressed) {
+    struct Entry {
+      uint32_t node;
+      int depth;
+      aabb box;
+    };
+    std::vector<Entry> stack = {{0, 0, bounds}};
+    while (!stack.empty()) {
+      Entry e = stack.back();
+      stack.pop_back();
+      const CompressedBVHNode &node = compressedNodes[e.node];
+      ++q.nodes;
+      aabb children[4];
+      for (int c = 0; c < node.nChildren; ++c) {
+        vec3 lo, hi;
+        for (int a = 0; a < 3; ++a) {
+          float scale = exp2i(node.exponent[a]);
+          lo[a] = dequantize(node.origin[a], scale, node.qMin[a][c]);
+          hi[a] = dequantize(node.origin[a], scale, node.qMax[a][c]);
+        }
+        children[c] = aabb(lo, hi);
+        if (node.nPrimitives[c] > 0) {
+          addLeaf(children[c], node.nPrimitives[c], e.depth + 1);
+        } else {
+          stack.push_back({node.child[c], e.depth + 1, children[c]});
+        }
+      }
+      addInterior(e.box, children, node.nChildren);
+    }
+  } else {
+    std::vector<std::pair<int, int>> stack = {{0, 0}};
+    while (!stack.empty()) {
+      int i = stack.back().first, depth = stack.back().second;
+      stack.pop_back();
+      const LinearBVHNode &node = nodes[i];
+      ++q.nodes;
+      if (node.nPrimitives > 0) {
+        addLeaf(node.box, node.nPrimitives, depth);
+        continue;
+      }
+      aabb children[2] = {nodes[i + 1].box, nodes[node.secondChildOffset].box};
+      addInterior(node.box, children, 2);
+      stack.push_back({i + 1, depth + 1});
+      stack.push_back({node.secondChildOffset, depth + 1});
+    }
+  }
+  q.meanOverlap = interiorNodes > 0 ? float(overlapSum / interiorNodes) : 0.f;
+  return q;
+}
+
+std::ostream &operator<<(std::ostream &out, const BVHQuality &q) {
+  out << q.nodes << " nodes, " << q.leaves << " leaves, depth " << q.maxDepth << ", SAH cost "
+      << q.sahCost << ", sibling overlap " << q.meanOverlap << " mean, " << q.maxOverlap
+      << " max\n  leaves by depth:";
+  for (size_t d = 0; d < q.leafDepths.size(); ++d) {
+    if (q.leafDepths[d] > 0) out << " " << d << ":" << q.leafDepths[d];
+  }
+  out << "\n  leaves by size:";
+  for (size_t n = 0; n < q.leafSizes.size(); ++n) {
+    if (q.leafSizes[n] > 0) out << " " << n << ":" << q.leafSizes[n];
+  }
+  return out << "\n";
+}
+
+uint32_t BVH::compress(const BVHNode *node, std::vector<CompressedBVHNode> &out) const {
+  // Gather up to 4 children by repeatedly opening the interior child with the
+  // largest surface area, which is the one most likely to be hit
+  const BVHNode *children[4];
+  int nChildren = 0;
+  if (node->left) {
+    children[nChildren++] = node->left.get();
+    children[nChildren++] = node->right.get();
+  } else {
+    // Single leaf tree
+    children[nChildren++] = node;
+  }
+  while (nChildren < 4) {
+    int best = -1;
+    float bestArea = -1.f;
+    for (int i = 0; i < nChildren; ++i) {
+      if (children[i]->left && children[i]->box.getSurfaceArea() > bestArea) {
+        best = i;
+        bestArea = children[i]->box.getSurfaceArea();
+      }
+    }
+    if (best < 0) break;
+    const BVHNode *opened = children[best];
+    children[best] = opened->left.get();
+    children[nChildren++] = opened->right.get();
+  }
+
+  CompressedBVHNode cnode{};
+  cnode.nChildren = nChildren;
+  for (int a = 0; a < 3; ++a) {
+    float lo = node->box.min()[a], hi = node->box.max()[a];
+    // Smallest grid step for which 255 steps still cover the whole node
+    int e = hi > lo ? static_cast<int>(std::ceil(std::log2((hi - lo) / 255.f))) : -126;
+    e = std::max(e, -126);
+    while (e < 127 && dequantize(lo, exp2i(e), 255) < hi) e++;
+    float scale = exp2i(e);
+    cnode.origin[a] = lo;
+    cnode.exponent[a] = e;
+    for (int c = 0; c < nChildren; ++c) {
+      float cMin = children[c]->box.min()[a], cMax = children[c]->box.max()[a];
+      int qMin = clamp(static_cast<int>(std::floor((cMin - lo) / scale)), 0, 255);
+      int qMax = clamp(static_cast<int>(std::ceil((cMax - lo) / scale)), 0, 255);
+      while (qMin > 0 && dequantize(lo, scale, qMin) > cMin) qMin--;
+      while (qMax < 255 && dequantize(lo, scale, qMax) < cMax) qMax++;
+      cnode.qMin[a][c] = qMin;
+      cnode.qMax[a][c] = qMax;
+    }
+  }
+
+  uint32_t index = out.size();
+  out.push_back(cnode);
+  for (int c = 0; c < nChildren; ++c) {
+    if (children[c]->left) {
+      uint32_t child = compress(children[c], out);
+      out[index].child[c] = child;
+      out[index].nPrimitives[c] = 0;
+    } else {
+      out[index].child[c] = children[c]->start;
+      out[index].nPrimitives[c] = children[c]->nPrimitives;
+    }
+  }
+  return index;
+}
+
+int BVH::flatten(const BVHNode *node, int *offset) {
+  LinearBVHNode &linear = nodes[*offset];
+  linear.box = node->box;
+  linear.pad = 0;
+  int nodeOffset = (*offset)++;
+  if (!node->left) {
+    linear.primitivesOffset = node->start;
+    linear.nPrimitives = node->nPrimitives;
+    linear.axis = 0;
+  } else {
+    linear.axis = node->axis;
+    linear.nPrimitives = 0;
+    flatten(node->left.get(), offset);
+    nodes[nodeOffset].secondChildOffset = flatten(node->right.get(), offset);
+  }
+  return nodeOffset;
+}
+
+void BVH::build(int nPrimitives) {
+  if (nPrimitives == 0) {
     return;
   }
+  raytracer::PerfScope perf(raytracer::PerfPhase::BVHBuild);
 
-  switch (sp) {
+  uPtr<BVHNode> root = mkU<BVHNode>();
+  totalNodes = 1;
+  switch (splitMethod) {
     case SplitMethod::SAH: {
-      buildSAH(root.get(), 0, hitables.size());
+      buildSAH(root.get(), 0, nPrimitives);
       break;
     }
     case SplitMethod::EqualCounts: {
-      buildEqualCounts(root.get(), 0, hitables.size());
+      buildEqualCounts(root.get(), 0, nPrimitives);
       break;
     }
     default: {
       break;
     }
   }
+
+  // The linked tree is only used for the build, traversal works on the
+  // compact depth first array
+  bounds = root->box;
+  if (layout == BVHLayout::Compressed) {
+    std::vector<CompressedBVHNode> out;
+    out.reserve(totalNodes / 3 + 1);
+    compress(root.get(), out);
+    compressedNodes = raytracer::Buffer<CompressedBVHNode>(std::move(out));
+  } else {
+    nodes.resize(totalNodes);
+    int offset = 0;
+    flatten(root.get(), &offset);
+  }
+}
+
+BVH::BVH(std::vector<sPtr<Hitable>> hl, float tMin, float tMax, SplitMethod sp,
+         BVHLayout layout)
+    : splitMethod(sp), layout(layout), tMin(tMin), tMax(tMax) {
+  primInfo.resize(hl.size());
+  for (size_t i = 0; i < hl.size(); ++i) {
+    aabb bounds;
+    if (!hl[i]->bounding_box(tMin, tMax, bounds)) {
+      std::cerr << "no bounding box in bvh_node constructor" << std::endl;
+    }
+    primInfo[i] = BVHPrimitiveInfo(i, bounds);
+  }
+  build(hl.size());
+
+  // Store the hitables in the order the leaves reference them
+  hitables.reserve(primInfo.size());
+  for (const BVHPrimitiveInfo &info : primInfo) {
+    hitables.push_back(std::move(hl[info.index]));
+  }
+  std::vector<BVHPrimitiveInfo>().swap(primInfo);
+}
+
+BVH::BVH(sPtr<const TriangleMesh> m, SplitMethod sp, BVHLayout layout)
+    : mesh(std::move(m)), splitMethod(sp), layout(layout), tMin(0.f), tMax(0.f) {
+  int nTriangles = mesh->numTriangles();
+  primInfo.resize(nTriangles);
+  for (int i = 0; i < nTriangles; ++i) {
+    primInfo[i] = BVHPrimitiveInfo(i, mesh->getTriangleBound(i));
+  }
+  build(nTriangles);
+
+  primIndices.resize(primInfo.size());
+  for (size_t i = 0; i < primInfo.size(); ++i) {
+    primIndices[i] = primInfo[i].index;
+  }
+  std::vector<BVHPrimitiveInfo>().swap(primInfo);
+}
+
+BVH::BVH(sPtr<const TriangleMesh> m, raytracer::Buffer<LinearBVHNode> nodes,
+         raytracer::Buffer<CompressedBVHNode> compressedNodes,
+         raytracer::Buffer<uint32_t> primIndices, SplitMethod sp, BVHLayout layout)
+    : mesh(std::move(m)),
+      primIndices(std::move(primIndices)),
+      splitMethod(sp),
+      layout(layout),
+      tMin(0.f),
+      tMax(0.f) {
+  if (layout == BVHLayout::Compressed) {
+    this->compressedNodes = std::move(compressedNodes);
+    totalNodes = this->compressedNodes.size();
+    // The root box is not stored, the decoded child boxes are a tight enough
+    // conservative stand-in
+    if (totalNodes > 0) {
+      const CompressedBVHNode &root = this->compressedNodes[0];
+      for (int a = 0; a < 3; ++a) {
+        float scale = exp2i(root.exponent[a]);
+        for (int c = 0; c < root.nChildren; ++c) {
+          vec3 lo = bounds.min(), hi = bounds.max();
+          lo[a] = std::min(lo[a], dequantize(root.origin[a], scale, root.qMin[a][c]));
+          hi[a] = std::max(hi[a], dequantize(root.origin[a], scale, root.qMax[a][c]));
+          bounds = aabb(lo, hi);
+        }
+      }
+    }
+  } else {
+    this->nodes = std::move(nodes);
+    totalNodes = this->nodes.size();
+    if (totalNodes > 0) bounds = this->nodes[0].box;
+  }
 }
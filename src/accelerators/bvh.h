@@ -1,19 +1,101 @@
 #pragma once
 
+#include <cstdint>
+#include <ostream>
 #include <vector>
 
+#include "core/buffer.h"
 #include "hitable.h"
 #include "smartpointerhelp.h"
+#include "triangle.h"
 
 enum class SplitMethod { EqualCounts, SAH };
+// Full stores one float box per binary node. Compressed collapses the tree to
+// 4 wide nodes with child boxes quantized to 8 bits, at about a third of the
+// memory for slightly more work per ray.
+enum class BVHLayout { Full, Compressed };
 
 class BVHNode;
 
+// Shape of a built tree, to compare split methods on a scene
+struct BVHQuality {
+  // A 4 wide compressed node counts once
+  int nodes = 0, leaves = 0, maxDepth = 0;
+  // Number of leaves at each depth, the root being at depth 0
+  std::vector<int> leafDepths;
+  // Number of leaves holding each number of primitives
+  std::vector<int> leafSizes;
+  // Expected cost of a ray through the root by the surface area heuristic,
+  // with the weights of the SAH build: 1 per node visited and 1 per
+  // primitive tested
+  float sahCost = 0.f;
+  // Surface area of the overlap of sibling boxes relative to their parent,
+  // summed over the pairs of siblings of a node. Mean and maximum over the
+  // interior nodes; overlap makes rays visit both subtrees.
+  float meanOverlap = 0.f, maxOverlap = 0.f;
+};
+
+// One line of totals, then the depth and leaf size histograms
+std::ostream& operator<<(std::ostream& out, const BVHQuality& quality);
+
+// Bounds of a primitive computed once before the build, so the build never
+// has to go through the virtual bounding_box of the hitables again
+struct BVHPrimitiveInfo {
+  BVHPrimitiveInfo() {}
+  BVHPrimitiveInfo(uint32_t index, const aabb& bounds)
+      : index(index), bounds(bounds), centroid(bounds.getCentroid()) {}
+  uint32_t index;
+  aabb bounds;
+  vec3 centroid;
+};
+
+// Node of the flattened tree, stored in depth first order so the first child
+// of an interior node always directly follows it. This is also the on disk
+// layout of the mesh cache, so it must stay a plain 32 byte struct.
+struct LinearBVHNode {
+  aabb box;
+  union {
+    int primitivesOffset;   // leaf
+    int secondChildOffset;  // interior
+  };
+  uint16_t nPrimitives;  // 0 for interior nodes
+  uint8_t axis;          // split axis of interior nodes
+  uint8_t pad;
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must be 32 bytes");
+
+// Node of the compressed 4 wide tree. Along each axis the child boxes are
+// stored as 8 bit steps of 2^exponent from the lower corner of the node box.
+// Minimums are rounded down and maximums up, so the decoded boxes always
+// contain the real ones. Exactly one cache line, and part of the cache layout.
+struct CompressedBVHNode {
+  vec3 origin;
+  int8_t exponent[3];
+  uint8_t nChildren;
+  uint8_t qMin[3][4], qMax[3][4];
+  // Node index of interior children, first primitive of leaf children
+  uint32_t child[4];
+  uint8_t nPrimitives[4];  // 0 for interior children
+  uint32_t pad;
+};
+static_assert(sizeof(CompressedBVHNode) == 64, "CompressedBVHNode must be 64 bytes");
+
+// The BVH is either built over a list of hitables, or over the triangles of a
+// single mesh. In the latter case the primitives are the triangle indices.
 class BVH : public Hitable {
 public:
   BVH() {}
   BVH(std::vector<sPtr<Hitable>> hitables, float tMin, float tMax,
-      SplitMethod sp = SplitMethod::EqualCounts);
+      SplitMethod sp = SplitMethod::EqualCounts, BVHLayout layout = BVHLayout::Full);
+  BVH(sPtr<const TriangleMesh> mesh, SplitMethod sp = SplitMethod::EqualCounts,
+      BVHLayout layout = BVHLayout::Full);
+  // Mesh BVH from an already flattened tree, e.g. a mapped mesh cache. Only
+  // the node array matching the layout is used.
+  BVH(sPtr<const TriangleMesh> mesh, raytracer::Buffer<LinearBVHNode> nodes,
+      raytracer::Buffer<CompressedBVHNode> compressedNodes,
+      raytracer::Buffer<uint32_t> primIndices, SplitMethod sp, BVHLayout layout);
+  BVH(const BVH&) = default;
+  BVH(BVH&&) = default;
   ~BVH() {}
 
   virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
@@ -23,23 +105,53 @@ public:
   void buildSAH(BVHNode* node, int start, int end);
   void buildEqualCounts(BVHNode* node, int start, int end);
 
+  SplitMethod getSplitMethod() const { return splitMethod; }
+  BVHLayout getLayout() const { return layout; }
+  const sPtr<const TriangleMesh>& getMesh() const { return mesh; }
+  const raytracer::Buffer<LinearBVHNode>& getNodes() const { return nodes; }
+  const raytracer::Buffer<CompressedBVHNode>& getCompressedNodes() const {
+    return compressedNodes;
+  }
+  const raytracer::Buffer<uint32_t>& getPrimIndices() const { return primIndices; }
+  BVHQuality getQuality() const;
+  // Bytes used by the tree itself, not counting the primitives
+  size_t getNodeBytes() const {
+    return nodes.size() * sizeof(LinearBVHNode) +
+           compressedNodes.size() * sizeof(CompressedBVHNode);
+  }
+
 private:
+  void build(int nPrimitives);
+  int flatten(const BVHNode* node, int* offset);
+  uint32_t compress(const BVHNode* node, std::vector<CompressedBVHNode>& out) const;
+  bool hitCompressed(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+  bool hitPrimitive(int i, const Ray& r, float tMin, float tMax, HitRecord& rec) const {
+    return mesh ? mesh->intersect(primIndices[i], r, tMin, tMax, rec)
+                : hitables[i]->hit(r, tMin, tMax, rec);
+  }
+
   std::vector<sPtr<Hitable>> hitables;
+  sPtr<const TriangleMesh> mesh;
+  // Triangle of the mesh referenced by each leaf slot, in BVH order
+  raytracer::Buffer<uint32_t> primIndices;
+  raytracer::Buffer<LinearBVHNode> nodes;
+  raytracer::Buffer<CompressedBVHNode> compressedNodes;
+  aabb bounds;
+  // Only alive during the build
+  std::vector<BVHPrimitiveInfo> primInfo;
+  int totalNodes = 0;
   SplitMethod splitMethod;
+  BVHLayout layout = BVHLayout::Full;
   float tMin, tMax;
-  uPtr<BVHNode> root;
-
-  friend class BVHNode;
 };
 
+// Node of the tree during the build, flattened into LinearBVHNode afterwards
 class BVHNode {
 public:
-  BVHNode(BVH* accelerator) : accelerator(accelerator), left(nullptr), right(nullptr) {}
+  BVHNode() : left(nullptr), right(nullptr) {}
   ~BVHNode() {}
-  virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
 
   aabb box;
-  BVH* accelerator;
-  int start, nPrimitives = 0;
+  int start, nPrimitives = 0, axis = 0;
   uPtr<BVHNode> left, right;
 };
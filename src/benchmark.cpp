@@ -0,0 +1,143 @@
+#include "benchmark.h"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "core/parallel.h"
+#include "io/image_io.h"
+#include "renderer.h"
+#include "scene.h"
+
+namespace {
+
+struct BenchmarkCase {
+  const char *scene;
+  int width, height, spp;
+};
+
+// Changing any of these invalidates the stored references
+const BenchmarkCase kCases[] = {
+    {"cornell_box", 256, 256, 16},  {"cornell_smoke", 256, 256, 16},
+    {"cornell_ball", 256, 256, 16}, {"final_scene", 256, 256, 16},
+    {"random_scene", 256, 256, 16},
+};
+
+// Lets the peak resident size start over from the current one, so every case
+// reports its own peak. Linux only, elsewhere the peak is that of the process.
+void resetPeakMemory() {
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+}
+
+double peakMemoryMB() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    long kb;
+    if (std::sscanf(line.c_str(), "VmHWM: %ld kB", &kb) == 1) {
+      return kb / 1024.0;
+    }
+  }
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+}
+
+// Over the gamma encoded values clamped to [0, 1] like the 8 bit outputs, so
+// a few fireflies do not dominate
+double rmse(const raytracer::Image &a, const raytracer::Image &b) {
+  double sum = 0.0;
+  for (int y = 0; y < a.getHeight(); ++y) {
+    for (int x = 0; x < a.getWidth(); ++x) {
+      for (int c = 0; c < 3; ++c) {
+        double d = std::sqrt(std::min(std::max(a(x, y)[c], 0.f), 1.f)) -
+                   std::sqrt(std::min(std::max(b(x, y)[c], 0.f), 1.f));
+        sum += d * d;
+      }
+    }
+  }
+  return std::sqrt(sum / (3.0 * a.getWidth() * a.getHeight()));
+}
+
+}  // namespace
+
+int runBenchmark(const Options &options) {
+  // The results own stdout, the progress messages of the renderer go to stderr
+  std::ostream results(std::cout.rdbuf());
+  std::streambuf *coutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+  raytracer::parallelInit();
+  bool passed = true;
+  AsyncImageWriter writer;
+  for (const BenchmarkCase &c : kCases) {
+    const SceneInfo *info = findScene(c.scene);
+    // Only settings that do not change the image are taken from the command
+    // line
+    Options o;
+    o.scene = c.scene;
+    o.width = c.width;
+    o.height = c.height;
+    o.spp = c.spp;
+    o.lookFrom = info->lookFrom;
+    o.lookAt = info->lookAt;
+    o.vfov = info->vfov;
+    o.tileSize = options.tileSize;
+    o.tileOrder = options.tileOrder;
+    o.costOrder = options.costOrder;
+    std::string reference = options.benchmark + "/" + c.scene + ".pfm";
+    raytracer::Image referenceImage;
+    bool haveReference = std::ifstream(reference).good();
+    if (haveReference && !readImage(reference, referenceImage)) {
+      passed = false;
+      continue;
+    }
+    o.output = haveReference ? options.benchmark + "/" + c.scene + ".last.pfm" : reference;
+
+    resetPeakMemory();
+    auto start = std::chrono::steady_clock::now();
+    Scene scene(c.scene);
+    std::chrono::duration<double> buildSeconds = std::chrono::steady_clock::now() - start;
+    Renderer renderer(&scene, makeCamera(o), o);
+    auto renderStart = std::chrono::steady_clock::now();
+    renderer.render(writer);
+    std::chrono::duration<double> renderSeconds = std::chrono::steady_clock::now() - renderStart;
+    raytracer::RayStats stats = renderer.getStats();
+    raytracer::Image image = renderer.getImage();
+
+    char line[512];
+    int n = std::snprintf(
+        line, sizeof(line),
+        "{\"scene\": \"%s\", \"width\": %d, \"height\": %d, \"spp\": %d, \"threads\": %d, "
+        "\"build_s\": %.4g, \"first_tile_s\": %.4g, \"render_s\": %.4g, \"rays\": %llu, "
+        "\"mrays_s\": %.4g, \"mrays_cpu_s\": %.4g, \"peak_rss_mb\": %.1f",
+        c.scene, c.width, c.height, c.spp, raytracer::threadCount(), buildSeconds.count(),
+        buildSeconds.count() + renderer.getFirstTileSeconds(), renderSeconds.count(),
+        (unsigned long long)stats.rays(), stats.rays() / renderSeconds.count() * 1e-6,
+        stats.rays() / renderer.getCpuSeconds() * 1e-6, peakMemoryMB());
+    std::string json(line, n);
+    if (!haveReference) {
+      json += ", \"reference\": \"created\"}";
+    } else if (referenceImage.getWidth() != image.getWidth() ||
+               referenceImage.getHeight() != image.getHeight()) {
+      json += ", \"reference\": \"size mismatch\", \"pass\": false}";
+      passed = false;
+    } else {
+      double error = rmse(image, referenceImage);
+      bool pass = error <= options.maxRmse;
+      std::snprintf(line, sizeof(line), ", \"rmse\": %.6g, \"pass\": %s}", error,
+                    pass ? "true" : "false");
+      json += line;
+      passed = passed && pass;
+    }
+    results << json << std::endl;
+  }
+  passed = writer.wait() && passed;
+  raytracer::parallelClean();
+  std::cout.rdbuf(coutBuffer);
+  return passed ? 0 : 1;
+}
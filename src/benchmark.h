@@ -0,0 +1,13 @@
+#pragma once
+
+#include "options.h"
+
+// Renders every built-in scene at a fixed resolution, sample count and seed,
+// so two builds do exactly the same work, and prints one JSON line per scene
+// on stdout: scene build and time to the first finished tile, rays/s over all
+// threads and per CPU second, peak resident memory and the RMSE against the
+// reference image <benchmark dir>/<scene>.pfm. A missing reference is created
+// from the render, otherwise the render is written next to it as
+// <scene>.last.pfm. Returns 0 when every image is within options.maxRmse of
+// its reference.
+int runBenchmark(const Options &options);
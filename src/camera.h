@@ -3,10 +3,10 @@
 
 #include "ray.h"
 
-vec3 random_in_unit_disk() {
+inline vec3 random_in_unit_disk() {
     vec3 p;
     do {
-        p = 2.0*vec3(drand48(), drand48(), 0); - vec3(1, 1, 0);
+        p = 2.0*vec3(random_float(), random_float(), 0); - vec3(1, 1, 0);
     } while (dot(p, p) >= 1.0);
     return p;
 }
@@ -29,13 +29,15 @@ class camera {
             vertical = 2 * focus_dist * half_height * v;
             lower_left_corner = origin - horizontal / 2 - vertical / 2 - focus_dist * w;
         }
-        Ray get_ray(float s, float t) {
+        Ray get_ray(float s, float t) const {
             vec3 rd = lens_radius * random_in_unit_disk();
             vec3 offset = u * rd.x() + v * rd.y();
-            float time = time0 + drand48() * (time1 - time0);
-            return Ray(origin + offset,
-                       lower_left_corner + s*horizontal + t*vertical - origin - offset,
-                       time);
+            float time = time0 + random_float() * (time1 - time0);
+            Ray r(origin + offset,
+                  lower_left_corner + s*horizontal + t*vertical - origin - offset,
+                  time);
+            r.coneSpread = pixel_spread;
+            return r;
         }
         vec3 origin;
         vec3 lower_left_corner;
@@ -44,5 +46,8 @@ class camera {
         vec3 u, v, w;
         float time0, time1; // shutter open/close time
         float lens_radius;
+        // Angle covered by a pixel, the spread of the ray cones. 0 turns
+        // texture filtering off.
+        float pixel_spread = 0.f;
 };
 #endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "smartpointerhelp.h"
+
+namespace raytracer {
+
+// Contiguous array that either owns its elements, or views memory owned by
+// someone else such as a memory mapped file. A view keeps its owner alive
+// through a shared pointer, so it can be handed around like an owned buffer.
+template <typename T>
+class Buffer {
+public:
+  Buffer() {}
+  Buffer(std::vector<T> v) : storage(std::move(v)), ptr(storage.data()), count(storage.size()) {}
+  Buffer(T *data, size_t size, sPtr<const void> owner)
+      : ptr(data), count(size), owner(std::move(owner)) {}
+  Buffer(const Buffer &b) { *this = b; }
+  Buffer(Buffer &&b) { *this = std::move(b); }
+
+  Buffer &operator=(const Buffer &b) {
+    storage = b.storage;
+    owner = b.owner;
+    ptr = b.isView() ? b.ptr : storage.data();
+    count = b.count;
+    return *this;
+  }
+  Buffer &operator=(Buffer &&b) {
+    bool view = b.isView();
+    storage = std::move(b.storage);
+    owner = std::move(b.owner);
+    ptr = view ? b.ptr : storage.data();
+    count = b.count;
+    b.ptr = nullptr;
+    b.count = 0;
+    return *this;
+  }
+
+  bool isView() const { return owner != nullptr; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  T *data() { return ptr; }
+  const T *data() const { return ptr; }
+  T &operator[](size_t i) { return ptr[i]; }
+  const T &operator[](size_t i) const { return ptr[i]; }
+  T *begin() { return ptr; }
+  T *end() { return ptr + count; }
+  const T *begin() const { return ptr; }
+  const T *end() const { return ptr + count; }
+
+  // Resizing always ends up with an owned copy of the elements
+  void resize(size_t size, const T &value = T()) {
+    if (isView()) {
+      storage.assign(ptr, ptr + std::min(size, count));
+      owner.reset();
+    }
+    storage.resize(size, value);
+    ptr = storage.data();
+    count = size;
+  }
+
+private:
+  std::vector<T> storage;
+  T *ptr = nullptr;
+  size_t count = 0;
+  sPtr<const void> owner;
+};
+
+}  // namespace raytracer
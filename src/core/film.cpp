@@ -0,0 +1,72 @@
+#include "core/film.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace raytracer {
+
+FilmTile::FilmTile(const Bounds2i &bounds)
+    : bounds(bounds), pixels(bounds.empty() ? 0 : bounds.area()) {}
+
+Film::Film(int width, int height)
+    : width(width), height(height), pixels(size_t(width) * height) {}
+
+FilmTile Film::getTile(const Bounds2i &bounds) const {
+  // Clip to the film so partial tiles at the border need no special casing
+  Bounds2i clipped(Point2i(std::max(bounds.min.x, 0), std::max(bounds.min.y, 0)),
+                   Point2i(std::min(bounds.max.x, width), std::min(bounds.max.y, height)));
+  return FilmTile(clipped);
+}
+
+void Film::mergeTile(const FilmTile &tile) {
+  const Bounds2i &b = tile.bounds;
+  for (int y = b.min.y; y < b.max.y; ++y) {
+    const FilmPixel *src = &tile.pixels[(y - b.min.y) * b.width()];
+    FilmPixel *dst = &pixels[size_t(y) * width + b.min.x];
+    for (int x = 0; x < b.width(); ++x) {
+      dst[x].sum += src[x].sum;
+      dst[x].weight += src[x].weight;
+      dst[x].sumLumSq += src[x].sumLumSq;
+    }
+  }
+}
+
+Image Film::getImage(const Bounds2i &bounds) const {
+  Image image(bounds.width(), bounds.height());
+  for (int y = bounds.min.y; y < bounds.max.y; ++y) {
+    for (int x = bounds.min.x; x < bounds.max.x; ++x) {
+      const FilmPixel &p = pixels[size_t(y) * width + x];
+      if (p.weight > 0.f) {
+        image(x - bounds.min.x, y - bounds.min.y) = p.sum / p.weight;
+      }
+    }
+  }
+  return image;
+}
+
+float Film::getError(const Bounds2i &bounds) const {
+  if (bounds.empty()) {
+    return 0.f;
+  }
+  double sumSq = 0.0;
+  for (int y = bounds.min.y; y < bounds.max.y; ++y) {
+    for (int x = bounds.min.x; x < bounds.max.x; ++x) {
+      const FilmPixel &p = pixels[size_t(y) * width + x];
+      if (p.weight < 2.f) {
+        return INFINITY;
+      }
+      float mean = luminance(p.sum) / p.weight;
+      float variance = std::max(0.f, p.sumLumSq / p.weight - mean * mean) / (p.weight - 1.f);
+      // Clamped to white in the output, the noise cannot be seen
+      if (mean - 3.f * std::sqrt(variance) > 1.f) {
+        continue;
+      }
+      // d sqrt(L) = dL / (2 sqrt(L)), with a floor so black pixels with a
+      // rare bright sample still count as noisy
+      sumSq += variance / (4.f * std::max(mean, 1e-3f));
+    }
+  }
+  return std::sqrt(sumSq / bounds.area());
+}
+
+}  // namespace raytracer
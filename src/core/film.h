@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include "core/image.h"
+#include "geometry.h"
+
+namespace raytracer {
+
+inline float luminance(const vec3 &c) { return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2]; }
+
+// Running sums of the weighted radiance samples of a pixel. The squared
+// luminance gives the variance estimate for adaptive sampling.
+struct FilmPixel {
+  vec3 sum;
+  float weight = 0.f;
+  float sumLumSq = 0.f;
+};
+
+// Accumulation buffer of one tile, owned by the thread rendering it so
+// adding samples never touches shared memory
+class FilmTile {
+public:
+  FilmTile(const Bounds2i &bounds);
+
+  const Bounds2i &getBounds() const { return bounds; }
+  // Row by row, for sending tiles between processes
+  std::vector<FilmPixel> &getPixels() { return pixels; }
+  const std::vector<FilmPixel> &getPixels() const { return pixels; }
+  // Pixel coordinates are in film space, not relative to the tile
+  void addSample(int x, int y, const vec3 &L, float weight = 1.f) {
+    FilmPixel &p = pixels[(y - bounds.min.y) * bounds.width() + (x - bounds.min.x)];
+    float lum = luminance(L);
+    p.sum += weight * L;
+    p.weight += weight;
+    p.sumLumSq += weight * lum * lum;
+  }
+
+private:
+  friend class Film;
+  Bounds2i bounds;
+  std::vector<FilmPixel> pixels;
+};
+
+// Linear float radiance and sample weights of the whole image, with y going
+// down from the top row. Tiles are merged by adding them in, so several
+// passes over the same pixels simply accumulate. Tonemapping and quantization
+// only happen when an image is written, see io/image_io.h.
+class Film {
+public:
+  Film(int width, int height);
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  Bounds2i getBounds() const { return Bounds2i(Point2i(0, 0), Point2i(width, height)); }
+
+  FilmTile getTile(const Bounds2i &bounds) const;
+  // Takes no lock: tiles merged concurrently must not overlap, which holds
+  // for the tiles of a single pass
+  void mergeTile(const FilmTile &tile);
+  // Weighted average of every pixel, black where there is no sample yet
+  Image getImage() const { return getImage(getBounds()); }
+  // The same for the pixels within bounds, as an image of their size
+  Image getImage(const Bounds2i &bounds) const;
+  // RMS of the estimated standard error of the pixel means within bounds,
+  // measured after gamma 2 like the written images so dark and bright regions
+  // are judged as they are seen. Pixel weights are taken as sample counts.
+  float getError(const Bounds2i &bounds) const;
+
+  // Raw accumulation state, row by row, for saving and restoring a render
+  std::vector<FilmPixel> &getPixels() { return pixels; }
+  const std::vector<FilmPixel> &getPixels() const { return pixels; }
+
+private:
+  int width, height;
+  std::vector<FilmPixel> pixels;
+};
+
+}  // namespace raytracer
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "geometry.h"
+
+namespace raytracer {
+
+static_assert(sizeof(vec3) == 3 * sizeof(float), "Image pixels are read as packed floats");
+
+// Linear RGB float image, stored row by row from the top left pixel
+class Image {
+public:
+  Image() {}
+  Image(int width, int height) : width(width), height(height), pixels(size_t(width) * height) {}
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  bool empty() const { return pixels.empty(); }
+  vec3 &operator()(int x, int y) { return pixels[size_t(y) * width + x]; }
+  const vec3 &operator()(int x, int y) const { return pixels[size_t(y) * width + x]; }
+  const vec3 *data() const { return pixels.data(); }
+
+private:
+  int width = 0, height = 0;
+  std::vector<vec3> pixels;
+};
+
+// Gamma 2, clamped to [0, 1] and rounded to 8 bits, the encoding of the LDR
+// formats
+inline uint8_t quantize(float v) {
+  v = std::sqrt(v > 0.f ? v : 0.f);
+  return static_cast<uint8_t>(255.f * (v < 1.f ? v : 1.f) + 0.5f);
+}
+
+}  // namespace raytracer
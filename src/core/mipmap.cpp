@@ -0,0 +1,33 @@
+#include "core/mipmap.h"
+
+#include <algorithm>
+
+namespace raytracer {
+
+std::vector<MipLevel> buildMipmap(std::vector<uint8_t> &texels, int width, int height) {
+  std::vector<MipLevel> mips = {{width, height, 0}};
+  // Up to 4/3 of the full image in all
+  texels.reserve(size_t(width) * height * 4);
+  while (mips.back().width > 1 || mips.back().height > 1) {
+    MipLevel fine = mips.back();
+    MipLevel coarse = {std::max(1, fine.width / 2), std::max(1, fine.height / 2), texels.size()};
+    texels.resize(texels.size() + size_t(coarse.width) * coarse.height * 3);
+    for (int y = 0; y < coarse.height; ++y) {
+      int y0 = std::min(2 * y, fine.height - 1), y1 = std::min(2 * y + 1, fine.height - 1);
+      for (int x = 0; x < coarse.width; ++x) {
+        int x0 = std::min(2 * x, fine.width - 1), x1 = std::min(2 * x + 1, fine.width - 1);
+        for (int c = 0; c < 3; ++c) {
+          auto at = [&](int tx, int ty) {
+            return int(texels[fine.offset + (size_t(ty) * fine.width + tx) * 3 + c]);
+          };
+          int sum = at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1);
+          texels[coarse.offset + (size_t(y) * coarse.width + x) * 3 + c] = (sum + 2) / 4;
+        }
+      }
+    }
+    mips.push_back(coarse);
+  }
+  return mips;
+}
+
+}  // namespace raytracer
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace raytracer {
+
+// One level of a mip pyramid of packed 8 bit RGB texels
+struct MipLevel {
+  int width, height;
+  // Index of the first byte of the level
+  size_t offset;
+};
+
+// Appends the levels below the width x height image at the start of texels,
+// each halving the one above with a 2x2 box filter and clamping at odd
+// edges, down to a single texel. Returns all levels, the full image first.
+std::vector<MipLevel> buildMipmap(std::vector<uint8_t> &texels, int width, int height);
+
+}  // namespace raytracer
@@ -1,5 +1,6 @@
 #include "parallel.h"
 
+#include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -87,6 +88,8 @@ void parallelClean() {
   shutDownThreads = false;
 }
 
+int threadCount() { return threads.size() + 1; }
+
 void ParallelFor(ThreadFunc1d func, int count, int chunkSize) {
   if (threads.empty() || count < chunkSize) {
     for (int i = 0; i < count; ++i) func(i);
@@ -13,6 +13,8 @@ extern thread_local int threadIndex;
 
 void parallelInit();
 void parallelClean();
+// Threads running the loops, the calling thread included
+int threadCount();
 void ParallelFor(ThreadFunc1d func, int count, int chunkSize);
 void ParallelFor2d(ThreadFunc2d func, const Point2i &count);
 
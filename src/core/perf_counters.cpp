@@ -0,0 +1,159 @@
+#include "core/perf_counters.h"
+
+#ifdef RAYTRACER_PERF_COUNTERS
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+#include "core/parallel.h"
+
+namespace raytracer {
+
+namespace {
+
+const int kCounters = 4;
+const uint32_t kEvents[kCounters] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                     PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+const char *kPhaseNames[int(PerfPhase::Count)] = {"BVH build", "Render"};
+
+// One group per thread, opened on first use, so the four counters are always
+// scheduled together
+struct ThreadCounters {
+  int fds[kCounters] = {-1, -1, -1, -1};
+  bool opened = false;
+  int depth = 0;
+
+  ~ThreadCounters() {
+    for (int fd : fds) {
+      if (fd >= 0) close(fd);
+    }
+  }
+
+  bool open() {
+    if (opened) {
+      return fds[0] >= 0;
+    }
+    opened = true;
+    for (int i = 0; i < kCounters; ++i) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = kEvents[i];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format =
+          PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+      if (fds[i] < 0) {
+        static std::atomic<bool> warned(false);
+        if (!warned.exchange(true)) {
+          std::cerr << "Performance counters unavailable: " << std::strerror(errno) << std::endl;
+        }
+        for (int &fd : fds) {
+          if (fd >= 0) close(fd);
+          fd = -1;
+        }
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Time enabled, time running, then the counters
+  bool read(uint64_t values[2 + kCounters]) {
+    uint64_t buffer[3 + kCounters];
+    if (::read(fds[0], buffer, sizeof(buffer)) != sizeof(buffer)) {
+      return false;
+    }
+    std::copy(buffer + 1, buffer + 3 + kCounters, values);
+    return true;
+  }
+};
+
+thread_local ThreadCounters threadCounters;
+
+std::mutex totalsMutex;
+// By phase and thread index
+std::map<int, PerfCounts> totals[int(PerfPhase::Count)];
+
+}  // namespace
+
+PerfScope::PerfScope(PerfPhase phase) : phase(phase), active(false) {
+  if (threadCounters.depth++ == 0 && threadCounters.open()) {
+    active = threadCounters.read(start);
+  }
+}
+
+PerfScope::~PerfScope() {
+  --threadCounters.depth;
+  uint64_t end[2 + kCounters];
+  if (!active || !threadCounters.read(end)) {
+    return;
+  }
+  // Scale up when the group shared the hardware with others for a while
+  uint64_t enabled = end[0] - start[0], running = end[1] - start[1];
+  double scale = running > 0 ? double(enabled) / running : 0.0;
+  uint64_t d[kCounters];
+  for (int i = 0; i < kCounters; ++i) {
+    d[i] = uint64_t((end[2 + i] - start[2 + i]) * scale);
+  }
+  PerfCounts counts;
+  counts.cycles = d[0];
+  counts.instructions = d[1];
+  counts.cacheMisses = d[2];
+  counts.branchMisses = d[3];
+  std::lock_guard<std::mutex> lock(totalsMutex);
+  totals[int(phase)][threadIndex] += counts;
+}
+
+void printPerfCounters(std::ostream &out, uint64_t rays) {
+  std::lock_guard<std::mutex> lock(totalsMutex);
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << std::setprecision(3);
+  for (int p = 0; p < int(PerfPhase::Count); ++p) {
+    if (totals[p].empty()) {
+      continue;
+    }
+    PerfCounts sum;
+    double minIpc = 1e30, maxIpc = 0.0;
+    for (const auto &t : totals[p]) {
+      sum += t.second;
+      if (t.second.cycles > 0) {
+        double ipc = double(t.second.instructions) / t.second.cycles;
+        minIpc = std::min(minIpc, ipc);
+        maxIpc = std::max(maxIpc, ipc);
+      }
+    }
+    out << kPhaseNames[p] << ": " << sum.cycles / 1e6 << "M cycles, IPC "
+        << (sum.cycles > 0 ? double(sum.instructions) / sum.cycles : 0.0);
+    if (totals[p].size() > 1 && maxIpc > 0.0) {
+      out << " (" << minIpc << "-" << maxIpc << " over " << totals[p].size() << " threads)";
+    }
+    out << ", " << sum.cacheMisses / 1e6 << "M cache misses, " << sum.branchMisses / 1e6
+        << "M branch misses";
+    if (PerfPhase(p) == PerfPhase::Render && rays > 0) {
+      out << "; per ray " << double(sum.cacheMisses) / rays << " cache misses, "
+          << double(sum.branchMisses) / rays << " branch misses";
+    }
+    out << std::endl;
+    totals[p].clear();
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace raytracer
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+// Hardware performance counters around the phases of a render, to tell
+// whether a phase is bound by memory or by computation. Built only with the
+// CMake option RAYTRACER_PERF_COUNTERS; otherwise every scope is an empty
+// object and nothing is measured or linked in. Counts are taken per thread
+// with perf_event_open on Linux, user space only.
+
+namespace raytracer {
+
+enum class PerfPhase { BVHBuild, Render, Count };
+
+struct PerfCounts {
+  uint64_t cycles = 0, instructions = 0, cacheMisses = 0, branchMisses = 0;
+
+  PerfCounts &operator+=(const PerfCounts &c) {
+    cycles += c.cycles;
+    instructions += c.instructions;
+    cacheMisses += c.cacheMisses;
+    branchMisses += c.branchMisses;
+    return *this;
+  }
+};
+
+#ifdef RAYTRACER_PERF_COUNTERS
+
+// Counts the calling thread from construction to destruction into the totals
+// of the phase. Nested scopes on one thread count only once, in the
+// outermost.
+class PerfScope {
+public:
+  explicit PerfScope(PerfPhase phase);
+  ~PerfScope();
+  PerfScope(const PerfScope &) = delete;
+  PerfScope &operator=(const PerfScope &) = delete;
+
+private:
+  PerfPhase phase;
+  bool active;
+  uint64_t start[6];
+};
+
+// Per phase totals, IPC and misses per ray, with the spread of the IPC over
+// the threads. Clears the totals afterwards.
+void printPerfCounters(std::ostream &out, uint64_t rays);
+
+#else
+
+class PerfScope {
+public:
+  explicit PerfScope(PerfPhase) {}
+};
+
+inline void printPerfCounters(std::ostream &, uint64_t) {}
+
+#endif
+
+}  // namespace raytracer
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+namespace raytracer {
+
+// PCG32 random number generator, see O'Neill 2014, "PCG: A Family of Simple
+// Fast Space-Efficient Statistically Good Algorithms for Random Number
+// Generation". Small enough to be reseeded for every pixel sample.
+class RNG {
+public:
+  RNG() { setSequence(0); }
+  explicit RNG(uint64_t sequence) { setSequence(sequence); }
+
+  void setSequence(uint64_t sequence) {
+    state = 0u;
+    inc = (sequence << 1u) | 1u;
+    uniformUInt32();
+    state += kDefaultState;
+    uniformUInt32();
+  }
+
+  uint32_t uniformUInt32() {
+    uint64_t old = state;
+    state = old * kMultiplier + inc;
+    uint32_t xorShifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = static_cast<uint32_t>(old >> 59u);
+    return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+  }
+
+  // Uniform in [0, 1)
+  float uniformFloat() { return (uniformUInt32() >> 8) * 0x1p-24f; }
+
+private:
+  static const uint64_t kDefaultState = 0x853c49e6748fea9bULL;
+  static const uint64_t kMultiplier = 0x5851f42d4c957f2dULL;
+  uint64_t state, inc;
+};
+
+// Finalizer of MurmurHash3, spreads neighbouring keys over all 64 bits
+inline uint64_t mixBits(uint64_t v) {
+  v ^= v >> 33;
+  v *= 0xff51afd7ed558ccdULL;
+  v ^= v >> 33;
+  v *= 0xc4ceb9fe1a85ec53ULL;
+  v ^= v >> 33;
+  return v;
+}
+
+// Generator behind random_float on the calling thread. The renderer reseeds
+// it for every pixel sample, so an image does not depend on which thread
+// rendered which tile, or on how the render was split up.
+inline RNG &threadRNG() {
+  static thread_local RNG rng;
+  return rng;
+}
+
+}  // namespace raytracer
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <time.h>
+
+#include <cstdint>
+
+namespace raytracer {
+
+// Work counters. Every thread counts into its own copy without any
+// synchronization, the renderer reads the difference over each tile it
+// renders. The BVH counts in locals and adds them once per ray.
+struct RayStats {
+  // Rays by the path vertex that spawned them. The integrator traces no
+  // separate shadow rays, light sampling picks the direction of the
+  // diffuse bounce.
+  uint64_t cameraRays = 0, specularRays = 0, diffuseRays = 0;
+  // BVH nodes whose bounds were tested, and primitives tested in leaves
+  uint64_t nodesVisited = 0, primitivesTested = 0;
+
+  uint64_t rays() const { return cameraRays + specularRays + diffuseRays; }
+
+  RayStats &operator+=(const RayStats &s) {
+    cameraRays += s.cameraRays;
+    specularRays += s.specularRays;
+    diffuseRays += s.diffuseRays;
+    nodesVisited += s.nodesVisited;
+    primitivesTested += s.primitivesTested;
+    return *this;
+  }
+  RayStats operator-(const RayStats &s) const {
+    RayStats d;
+    d.cameraRays = cameraRays - s.cameraRays;
+    d.specularRays = specularRays - s.specularRays;
+    d.diffuseRays = diffuseRays - s.diffuseRays;
+    d.nodesVisited = nodesVisited - s.nodesVisited;
+    d.primitivesTested = primitivesTested - s.primitivesTested;
+    return d;
+  }
+};
+
+inline RayStats &threadStats() {
+  static thread_local RayStats stats;
+  return stats;
+}
+
+// CPU time of the calling thread. Unlike the wall clock it does not grow when
+// there are more threads than cores, so it measures the cost of the work.
+inline double threadCpuSeconds() {
+  timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+// One tile rendered by one thread, for the execution trace. Times are in
+// seconds since the renderer was created.
+struct TileEvent {
+  int tile, thread, spp;
+  double start, duration;
+  RayStats stats;
+};
+
+}  // namespace raytracer
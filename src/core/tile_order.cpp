@@ -0,0 +1,63 @@
+#include "core/tile_order.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+
+namespace raytracer {
+
+// Distance along the Hilbert curve through an n x n grid, n a power of two
+static uint64_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y) {
+  uint64_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+    d += uint64_t(s) * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant so the curve continues where it left off
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+std::vector<int> tileRanks(const std::vector<Bounds2i> &tiles, int tileSize, TileOrder order) {
+  std::vector<int> byOrder(tiles.size());
+  std::iota(byOrder.begin(), byOrder.end(), 0);
+  if (order != TileOrder::Scanline && !tiles.empty()) {
+    int maxX = 0, maxY = 0;
+    for (const Bounds2i &t : tiles) {
+      maxX = std::max(maxX, t.min.x / tileSize);
+      maxY = std::max(maxY, t.min.y / tileSize);
+    }
+    std::vector<double> keys(tiles.size());
+    uint32_t n = 1;
+    while (n <= uint32_t(std::max(maxX, maxY))) {
+      n *= 2;
+    }
+    for (size_t i = 0; i < tiles.size(); ++i) {
+      int x = tiles[i].min.x / tileSize, y = tiles[i].min.y / tileSize;
+      if (order == TileOrder::Hilbert) {
+        keys[i] = hilbertIndex(n, x, y);
+      } else {
+        // Ring around the center first, then the angle within the ring
+        double dx = x - 0.5 * maxX, dy = y - 0.5 * maxY;
+        double ring = std::floor(std::max(std::abs(dx), std::abs(dy)) + 0.5);
+        keys[i] = ring * 8.0 + std::atan2(dy, dx) + M_PI;
+      }
+    }
+    std::stable_sort(byOrder.begin(), byOrder.end(),
+                     [&](int a, int b) { return keys[a] < keys[b]; });
+  }
+  std::vector<int> ranks(tiles.size());
+  for (size_t i = 0; i < byOrder.size(); ++i) {
+    ranks[byOrder[i]] = i;
+  }
+  return ranks;
+}
+
+}  // namespace raytracer
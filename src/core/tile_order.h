@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.h"
+
+namespace raytracer {
+
+// Order in which the tiles of an image are handed to the threads. Scanline
+// goes row by row, so the threads work on tiles far apart in the image and
+// share little of the BVH and textures. Hilbert follows a Hilbert curve over
+// the tile grid, keeping the tiles in flight next to each other. Spiral
+// starts at the image center and works outwards, where most subjects are.
+enum class TileOrder { Scanline, Hilbert, Spiral };
+
+// Position of every tile in the given order. Tiles are placed on a grid of
+// tileSize pixels by their min corner.
+std::vector<int> tileRanks(const std::vector<Bounds2i> &tiles, int tileSize, TileOrder order);
+
+}  // namespace raytracer
@@ -0,0 +1,301 @@
+#include "distributed.h"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+
+#include "core/parallel.h"
+#include "renderer.h"
+
+namespace {
+
+// Both ends are the same build on the same kind of machine, structs are sent
+// as they are laid out in memory. The hello message guards against anything
+// else connecting.
+const uint32_t kProtocolVersion = 5;
+const uint32_t kEndianMarker = 0x01020304;
+// Tasks per message, and batches a worker may have queued so it never waits
+// for the next one
+const int kBatchSize = 16;
+const int kBatchesInFlight = 2;
+// Largest payload accepted, a result for a tile of up to about 7000 x 7000
+// pixels, so a corrupt header cannot ask for gigabytes
+const uint32_t kMaxPayload = 1u << 30;
+
+enum MessageType : uint32_t { kHello = 1, kJob, kTasks, kTileResult, kFinish };
+
+struct MessageHeader {
+  uint32_t type;
+  uint32_t size;
+};
+
+struct HelloMessage {
+  uint32_t version;
+  uint32_t endianMarker;
+  uint32_t pixelSize;
+};
+
+// Everything that decides the samples besides the tile and sample indices
+struct JobMessage {
+  int32_t width, height;
+  uint32_t seed;
+  vec3 lookFrom, lookAt, up;
+  float vfov, aperture, focusDistance;
+  // Name of the built-in scene and the mesh of cornell_mesh, zero terminated
+  char scene[32];
+  char mesh[256];
+};
+
+// Copied to and from the payloads byte by byte
+static_assert(std::is_trivially_copyable<JobMessage>::value, "JobMessage is sent as bytes");
+static_assert(std::is_trivially_copyable<TileTask>::value, "TileTask is sent as bytes");
+static_assert(std::is_trivially_copyable<TileResult>::value, "TileResult is sent as bytes");
+static_assert(std::is_trivially_copyable<raytracer::FilmPixel>::value,
+              "FilmPixel is sent as bytes");
+
+bool sendMessage(Socket &socket, uint32_t type, const void *data, size_t size) {
+  MessageHeader header = {type, uint32_t(size)};
+  return socket.sendAll(&header, sizeof(header)) && socket.sendAll(data, size);
+}
+
+bool receiveMessage(Socket &socket, MessageHeader &header, std::vector<char> &payload) {
+  if (!socket.receiveAll(&header, sizeof(header)) || header.size > kMaxPayload) {
+    return false;
+  }
+  payload.resize(header.size);
+  return socket.receiveAll(payload.data(), payload.size());
+}
+
+// A result followed by the pixels of its tile
+std::vector<char> encodeResult(const TileResult &result, raytracer::FilmTile &tile) {
+  const std::vector<raytracer::FilmPixel> &pixels = tile.getPixels();
+  std::vector<char> data(sizeof(TileResult) + pixels.size() * sizeof(raytracer::FilmPixel));
+  std::memcpy(data.data(), &result, sizeof(TileResult));
+  std::memcpy(data.data() + sizeof(TileResult), pixels.data(),
+              pixels.size() * sizeof(raytracer::FilmPixel));
+  return data;
+}
+
+}  // namespace
+
+RenderCoordinator::~RenderCoordinator() { finish(); }
+
+bool RenderCoordinator::listen(const std::string &address) {
+  server = Socket::listen(address);
+  if (server.valid()) {
+    std::cout << "Waiting for workers on " << address << std::endl;
+  }
+  return server.valid();
+}
+
+void RenderCoordinator::acceptWorker() {
+  Socket socket = server.accept();
+  MessageHeader header;
+  std::vector<char> payload;
+  HelloMessage hello;
+  if (!socket.valid() || !receiveMessage(socket, header, payload) || header.type != kHello ||
+      payload.size() != sizeof(hello)) {
+    std::cerr << "Rejected a connection that is not a worker" << std::endl;
+    return;
+  }
+  std::memcpy(&hello, payload.data(), sizeof(hello));
+  if (hello.version != kProtocolVersion || hello.endianMarker != kEndianMarker ||
+      hello.pixelSize != sizeof(raytracer::FilmPixel)) {
+    std::cerr << "Rejected a worker of another version" << std::endl;
+    return;
+  }
+  JobMessage job = {options.width,    options.height,   options.seed,
+                    options.lookFrom, options.lookAt,   options.up,
+                    options.vfov,     options.aperture, options.focusDistance, {}};
+  std::strncpy(job.scene, options.scene.c_str(), sizeof(job.scene) - 1);
+  std::strncpy(job.mesh, options.mesh.c_str(), sizeof(job.mesh) - 1);
+  if (!sendMessage(socket, kJob, &job, sizeof(job))) {
+    return;
+  }
+  workers.emplace_back(new Worker{std::move(socket), {}});
+  std::cout << "Worker " << workers.size() << " connected" << std::endl;
+}
+
+bool RenderCoordinator::sendTasks(Worker &worker, std::vector<TileTask> &pending) {
+  while (!pending.empty() && worker.inFlight.size() < size_t(kBatchSize * kBatchesInFlight)) {
+    size_t n = std::min(pending.size(), size_t(kBatchSize));
+    std::vector<TileTask> batch(pending.end() - n, pending.end());
+    pending.resize(pending.size() - n);
+    worker.inFlight.insert(worker.inFlight.end(), batch.begin(), batch.end());
+    if (!sendMessage(worker.socket, kTasks, batch.data(), batch.size() * sizeof(TileTask))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RenderCoordinator::receiveResult(Worker &worker, const TileCallback &onTile) {
+  MessageHeader header;
+  std::vector<char> payload;
+  if (!receiveMessage(worker.socket, header, payload) || header.type != kTileResult ||
+      payload.size() < sizeof(TileResult)) {
+    return false;
+  }
+  TileResult result;
+  std::memcpy(&result, payload.data(), sizeof(result));
+  auto it = std::find_if(worker.inFlight.begin(), worker.inFlight.end(),
+                         [&](const TileTask &t) { return t.tile == result.task.tile; });
+  if (it == worker.inFlight.end()) {
+    return false;
+  }
+  // Only the tile index comes from the worker, the bounds and samples are
+  // those of the task it was sent
+  result.task = *it;
+  raytracer::FilmTile tile(result.task.bounds);
+  std::vector<raytracer::FilmPixel> &pixels = tile.getPixels();
+  if (payload.size() != sizeof(TileResult) + pixels.size() * sizeof(raytracer::FilmPixel)) {
+    return false;
+  }
+  worker.inFlight.erase(it);
+  std::memcpy(pixels.data(), payload.data() + sizeof(TileResult),
+              pixels.size() * sizeof(raytracer::FilmPixel));
+  onTile(result, tile);
+  return true;
+}
+
+bool RenderCoordinator::run(const std::vector<TileTask> &tasks, Clock::time_point deadline,
+                            const std::atomic<bool> &stop, const TileCallback &onTile) {
+  // Handed out from the back, reverse so tiles go out in order
+  std::vector<TileTask> pending(tasks.rbegin(), tasks.rend());
+  bool complete = true;
+  std::vector<pollfd> fds;
+  while (true) {
+    if (!pending.empty() && (stop || Clock::now() >= deadline)) {
+      pending.clear();
+      complete = false;
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+      if (!sendTasks(*workers[i], pending)) {
+        // Picked up again in the poll below, where the connection is dropped
+        break;
+      }
+    }
+    bool busy = std::any_of(workers.begin(), workers.end(),
+                            [](const std::unique_ptr<Worker> &w) { return !w->inFlight.empty(); });
+    if (pending.empty() && !busy) {
+      return complete;
+    }
+
+    fds.assign(1, pollfd{server.getFd(), POLLIN, 0});
+    for (const std::unique_ptr<Worker> &w : workers) {
+      fds.push_back(pollfd{w->socket.getFd(), POLLIN, 0});
+    }
+    // Wake up now and then to notice the deadline or a stop request
+    int timeout = 100;
+    if (deadline != Clock::time_point::max()) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+      timeout = int(std::max<int64_t>(0, std::min<int64_t>(timeout, left.count() + 1)));
+    }
+    if (poll(fds.data(), fds.size(), timeout) <= 0) {
+      continue;
+    }
+    // Workers first, fds only lines up with the list before anyone is added
+    for (size_t i = workers.size(); i-- > 0;) {
+      if (!fds[i + 1].revents) {
+        continue;
+      }
+      Worker &w = *workers[i];
+      if (!receiveResult(w, onTile)) {
+        std::cerr << "Lost a worker, " << w.inFlight.size() << " tiles go to the others"
+                  << std::endl;
+        pending.insert(pending.end(), w.inFlight.rbegin(), w.inFlight.rend());
+        workers.erase(workers.begin() + i);
+      }
+    }
+    if (fds[0].revents) {
+      acceptWorker();
+    }
+  }
+}
+
+void RenderCoordinator::finish() {
+  for (const std::unique_ptr<Worker> &w : workers) {
+    sendMessage(w->socket, kFinish, nullptr, 0);
+  }
+  workers.clear();
+  server.close();
+}
+
+bool RenderWorker::connect(const std::string &address, Options &options) {
+  const int kAttempts = 100;
+  for (int i = 0; i < kAttempts && !socket.valid(); ++i) {
+    if (i > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    socket = Socket::connect(address);
+  }
+  if (!socket.valid()) {
+    std::cerr << "Cannot connect to a coordinator on " << address << std::endl;
+    return false;
+  }
+  HelloMessage hello = {kProtocolVersion, kEndianMarker, sizeof(raytracer::FilmPixel)};
+  MessageHeader header;
+  std::vector<char> payload;
+  if (!sendMessage(socket, kHello, &hello, sizeof(hello)) ||
+      !receiveMessage(socket, header, payload) || header.type != kJob ||
+      payload.size() != sizeof(JobMessage)) {
+    std::cerr << "The coordinator on " << address << " did not accept this worker" << std::endl;
+    return false;
+  }
+  JobMessage job;
+  std::memcpy(&job, payload.data(), sizeof(job));
+  options.width = job.width;
+  options.height = job.height;
+  options.seed = job.seed;
+  options.lookFrom = job.lookFrom;
+  options.lookAt = job.lookAt;
+  options.up = job.up;
+  options.vfov = job.vfov;
+  options.aperture = job.aperture;
+  options.focusDistance = job.focusDistance;
+  job.scene[sizeof(job.scene) - 1] = '\0';
+  options.scene = job.scene;
+  job.mesh[sizeof(job.mesh) - 1] = '\0';
+  options.mesh = job.mesh;
+  std::cout << "Connected to " << address << ", rendering " << options.scene << " at "
+            << job.width << "x" << job.height << std::endl;
+  return true;
+}
+
+bool RenderWorker::serve(const Renderer &renderer) {
+  MessageHeader header;
+  std::vector<char> payload;
+  while (receiveMessage(socket, header, payload)) {
+    if (header.type == kFinish) {
+      return true;
+    }
+    if (header.type != kTasks || payload.size() % sizeof(TileTask) != 0) {
+      break;
+    }
+    std::vector<TileTask> tasks(payload.size() / sizeof(TileTask));
+    std::memcpy(tasks.data(), payload.data(), payload.size());
+    std::vector<raytracer::FilmTile> tiles(tasks.size(), raytracer::FilmTile(Bounds2i()));
+    std::vector<TileResult> results(tasks.size());
+    raytracer::ParallelFor(
+        [&](int i) {
+          double start = raytracer::threadCpuSeconds();
+          raytracer::RayStats before = raytracer::threadStats();
+          tiles[i] = renderer.traceTile(tasks[i].bounds, tasks[i].firstSample, tasks[i].spp);
+          results[i] = {tasks[i], raytracer::threadCpuSeconds() - start,
+                        raytracer::threadStats() - before};
+        },
+        tasks.size(), 1);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      std::vector<char> result = encodeResult(results[i], tiles[i]);
+      if (!sendMessage(socket, kTileResult, result.data(), result.size())) {
+        break;
+      }
+    }
+  }
+  std::cerr << "Lost the connection to the coordinator" << std::endl;
+  return false;
+}
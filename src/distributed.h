@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/film.h"
+#include "core/stats.h"
+#include "io/socket.h"
+#include "options.h"
+
+class Renderer;
+
+// Samples firstSample to firstSample + spp - 1 of every pixel of a tile
+struct TileTask {
+  int32_t tile;
+  Bounds2i bounds;
+  int32_t firstSample, spp;
+};
+
+// What a worker reports besides the pixels of a finished tile
+struct TileResult {
+  TileTask task;
+  // CPU seconds the tile took
+  double seconds;
+  raytracer::RayStats stats;
+};
+
+// Hands the tiles of each render pass out to worker processes connected over
+// a socket and merges the float tiles they send back. Workers may join at any
+// time, the tiles of a worker that goes away are given to the others.
+// Everything runs on the calling thread, so results are merged without locks.
+class RenderCoordinator {
+public:
+  using Clock = std::chrono::steady_clock;
+  // Called with every finished tile. The task of the result is the one that
+  // was handed out, not the copy the worker sent back.
+  using TileCallback = std::function<void(const TileResult &, raytracer::FilmTile &)>;
+
+  explicit RenderCoordinator(const Options &options) : options(options) {}
+  ~RenderCoordinator();
+
+  bool listen(const std::string &address);
+  // Renders the tasks on the workers, calling onTile for each finished one.
+  // Waits for a worker if none is connected. Once the deadline passes or stop
+  // is set no more tasks are handed out, returns false if any was left.
+  bool run(const std::vector<TileTask> &tasks, Clock::time_point deadline,
+           const std::atomic<bool> &stop, const TileCallback &onTile);
+  // Tells the workers to exit
+  void finish();
+
+private:
+  struct Worker {
+    Socket socket;
+    std::vector<TileTask> inFlight;
+  };
+
+  void acceptWorker();
+  bool sendTasks(Worker &worker, std::vector<TileTask> &pending);
+  bool receiveResult(Worker &worker, const TileCallback &onTile);
+
+  Options options;
+  Socket server;
+  std::vector<std::unique_ptr<Worker>> workers;
+};
+
+// Worker side: connects to a coordinator, takes over its scene, image and camera
+// settings and renders the tiles it is sent on the local thread pool
+class RenderWorker {
+public:
+  // Retries for a while, so workers may be started before the coordinator.
+  // On success options holds the settings of the render.
+  bool connect(const std::string &address, Options &options);
+  // Renders tiles until the coordinator is done, false if the connection was
+  // lost first
+  bool serve(const Renderer &renderer);
+
+private:
+  Socket socket;
+};
@@ -2,24 +2,27 @@
 #define VEC3H
 
 #include <array>
+#include <cassert>
 #include <cmath>
 #include <iostream>
 
+#include "core/rng.h"
+
 template <class T>
 constexpr const T &clamp(const T &v, const T &lo, const T &hi) {
   assert(!(hi < lo));
   return (v < lo) ? lo : (hi < v) ? hi : v;
 }
 
+// Uniform in [0, 1), from the generator of the calling thread
 inline float random_float() {
-  return (float)rand() / RAND_MAX;
+  return raytracer::threadRNG().uniformFloat();
 }
 
 template <class T>
 class Point2 {
 public:
   Point2() {}
-  Point2(const Point2<T> &p) : x(p.x), y(p.y) {}
   Point2(T x, T y) : x(x), y(y) {}
   T &operator[](int i) {
     return i == 0 ? x : y;
@@ -35,7 +38,6 @@ public:
     x -= p.x;
     y -= p.y;
   }
-  ~Point2() {}
   T x, y;
 };
 
@@ -43,6 +45,21 @@ using Point2i = Point2<int>;
 using Point2f = Point2<float>;
 using Point2d = Point2<double>; 
 
+// Integer pixel rectangle, min inclusive and max exclusive
+struct Bounds2i {
+  Bounds2i() : min(0, 0), max(0, 0) {}
+  Bounds2i(const Point2i &min, const Point2i &max) : min(min), max(max) {}
+  int width() const { return max.x - min.x; }
+  int height() const { return max.y - min.y; }
+  int area() const { return width() * height(); }
+  bool empty() const { return max.x <= min.x || max.y <= min.y; }
+  bool operator==(const Bounds2i &b) const {
+    return min.x == b.min.x && min.y == b.min.y && max.x == b.max.x && max.y == b.max.y;
+  }
+  bool operator!=(const Bounds2i &b) const { return !(*this == b); }
+  Point2i min, max;
+};
+
 class vec3 {
  public:
   vec3(float e0, float e1, float e2) : e({e0, e1, e2}) {}
@@ -203,7 +220,7 @@ inline vec3 Max(const vec3 &a, const vec3 &b) {
 
 inline void de_nan(vec3 &v) {
   for (int i = 0; i < 3; i++) {
-    if (isnan(v[i])) v[i] = 0.f;
+    if (std::isnan(v[i])) v[i] = 0.f;
   }
 }
 
@@ -43,6 +43,7 @@ rotate_y::rotate_y(Hitable *p, float angle) : ptr(p) {
             }
         }
     }
+    bbox = aabb(min, max);
 }
 
 bool rotate_y::hit(const Ray& r, float t_min, float t_max, HitRecord& rec) const {
@@ -11,6 +11,11 @@ struct HitRecord {
   float t, u, v;
   vec3 p, normal;
   material* mat_ptr;
+  // World length of a unit step in u and in v at p, 0 when unknown. Set by
+  // the shapes, for texture filtering.
+  float dpdu = 0.f, dpdv = 0.f;
+  // Extent of the ray footprint at p in u and v, set by the integrator
+  float du = 0.f, dv = 0.f;
 };
 
 class Hitable {
@@ -25,7 +25,7 @@ bool hitable_list::bounding_box(float t0, float t1, aabb& box) const {
     }
     box = temp_box;
     for (int i = 1; i < list_size; i++) {
-        if(!list[0]->bounding_box(t0, t1, temp_box)) {
+        if(!list[i]->bounding_box(t0, t1, temp_box)) {
             return false;
         }
         box = surrounding_box(box, temp_box);
@@ -1,6 +1,8 @@
 #ifndef HITABLELISTH
 #define HITABLELISTH
 
+#include <algorithm>
+
 #include "hitable.h"
 
 class hitable_list : public Hitable {
@@ -21,7 +23,7 @@ class hitable_list : public Hitable {
   }
 
   virtual vec3 random(const vec3& o) const {
-    int randInd = rand() % list_size;
+    int randInd = std::min(int(random_float() * list_size), list_size - 1);
     return list[randInd]->random(o);
   }
 
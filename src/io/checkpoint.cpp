@@ -0,0 +1,142 @@
+#include "io/checkpoint.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char kMagic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+// Bump whenever the layout of the header or of the stored arrays changes
+const uint32_t kVersion = 3;
+const uint32_t kEndianMarker = 0x01020304;
+const uint32_t kMaxNameLength = 4096;
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endianMarker;
+  uint32_t pixelSize;
+  int32_t width, height, tileSize;
+  int32_t cropMinX, cropMinY, cropMaxX, cropMaxY;
+  int32_t spp, passSpp, minSpp;
+  uint32_t progressive, seed;
+  float adaptiveThreshold;
+  float lookFrom[3], lookAt[3], up[3];
+  float vfov, aperture, focusDistance;
+  double elapsed;
+  // The scene and mesh names follow the header, then the arrays
+  uint32_t sceneLength, meshLength;
+  uint64_t nTiles, nPixels;
+};
+
+}  // namespace
+
+bool writeCheckpoint(const std::string &path, const RenderCheckpoint &c) {
+  CheckpointHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.endianMarker = kEndianMarker;
+  header.pixelSize = sizeof(raytracer::FilmPixel);
+  header.width = c.width;
+  header.height = c.height;
+  header.tileSize = c.tileSize;
+  header.cropMinX = c.crop.min.x;
+  header.cropMinY = c.crop.min.y;
+  header.cropMaxX = c.crop.max.x;
+  header.cropMaxY = c.crop.max.y;
+  header.spp = c.spp;
+  header.passSpp = c.passSpp;
+  header.minSpp = c.minSpp;
+  header.progressive = c.progressive;
+  header.seed = c.seed;
+  header.adaptiveThreshold = c.adaptiveThreshold;
+  for (int a = 0; a < 3; ++a) {
+    header.lookFrom[a] = c.lookFrom[a];
+    header.lookAt[a] = c.lookAt[a];
+    header.up[a] = c.up[a];
+  }
+  header.vfov = c.vfov;
+  header.aperture = c.aperture;
+  header.focusDistance = c.focusDistance;
+  header.elapsed = c.elapsed;
+  header.sceneLength = c.scene.size();
+  header.meshLength = c.mesh.size();
+  header.nTiles = c.tileSpp.size();
+  header.nPixels = c.pixels.size();
+
+  std::string tmpPath = path + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "wb");
+  if (!file) {
+    std::cerr << "Open file failed: " << tmpPath << std::endl;
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(c.scene.data(), 1, c.scene.size(), file) == c.scene.size() &&
+            fwrite(c.mesh.data(), 1, c.mesh.size(), file) == c.mesh.size() &&
+            fwrite(c.tileSpp.data(), sizeof(int32_t), c.tileSpp.size(), file) == c.tileSpp.size() &&
+            fwrite(c.tileActive.data(), 1, c.tileActive.size(), file) == c.tileActive.size() &&
+            fwrite(c.pixels.data(), sizeof(raytracer::FilmPixel), c.pixels.size(), file) ==
+                c.pixels.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::cerr << "Writing checkpoint " << path << " failed" << std::endl;
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool readCheckpoint(const std::string &path, RenderCheckpoint &c) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    std::cerr << "Open file failed: " << path << std::endl;
+    return false;
+  }
+  CheckpointHeader header;
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+            header.version == kVersion && header.endianMarker == kEndianMarker &&
+            header.pixelSize == sizeof(raytracer::FilmPixel) &&
+            header.nPixels == uint64_t(header.width) * header.height &&
+            header.sceneLength <= kMaxNameLength && header.meshLength <= kMaxNameLength;
+  if (ok) {
+    c.width = header.width;
+    c.height = header.height;
+    c.tileSize = header.tileSize;
+    c.crop = Bounds2i(Point2i(header.cropMinX, header.cropMinY),
+                      Point2i(header.cropMaxX, header.cropMaxY));
+    c.spp = header.spp;
+    c.passSpp = header.passSpp;
+    c.minSpp = header.minSpp;
+    c.progressive = header.progressive;
+    c.seed = header.seed;
+    c.adaptiveThreshold = header.adaptiveThreshold;
+    c.lookFrom = vec3(header.lookFrom[0], header.lookFrom[1], header.lookFrom[2]);
+    c.lookAt = vec3(header.lookAt[0], header.lookAt[1], header.lookAt[2]);
+    c.up = vec3(header.up[0], header.up[1], header.up[2]);
+    c.vfov = header.vfov;
+    c.aperture = header.aperture;
+    c.focusDistance = header.focusDistance;
+    c.elapsed = header.elapsed;
+    c.scene.resize(header.sceneLength);
+    c.mesh.resize(header.meshLength);
+    c.tileSpp.resize(header.nTiles);
+    c.tileActive.resize(header.nTiles);
+    c.pixels.resize(header.nPixels);
+    ok = fread(&c.scene[0], 1, c.scene.size(), file) == c.scene.size() &&
+         fread(&c.mesh[0], 1, c.mesh.size(), file) == c.mesh.size() &&
+         fread(c.tileSpp.data(), sizeof(int32_t), c.tileSpp.size(), file) == c.tileSpp.size() &&
+         fread(c.tileActive.data(), 1, c.tileActive.size(), file) == c.tileActive.size() &&
+         fread(c.pixels.data(), sizeof(raytracer::FilmPixel), c.pixels.size(), file) ==
+             c.pixels.size();
+  }
+  fclose(file);
+  if (!ok) {
+    std::cerr << "Invalid or truncated checkpoint " << path << std::endl;
+  }
+  return ok;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/film.h"
+
+// Saved state of an unfinished render. Pixel samples are seeded from their
+// pixel and index, so the film sums and the number of samples taken per tile
+// are all that is needed to continue with exactly the result of an
+// uninterrupted run.
+struct RenderCheckpoint {
+  // Settings the render was started with, a resume must use the same
+  int32_t width = 0, height = 0, tileSize = 0;
+  Bounds2i crop;
+  int32_t spp = 0, passSpp = 0, minSpp = 0;
+  uint32_t progressive = 0, seed = 0;
+  float adaptiveThreshold = 0.f;
+  std::string scene, mesh;
+  vec3 lookFrom, lookAt, up;
+  float vfov = 0.f, aperture = 0.f, focusDistance = 0.f;
+  // Seconds spent rendering so far, counted against the time budget
+  double elapsed = 0.0;
+  std::vector<int32_t> tileSpp;
+  std::vector<uint8_t> tileActive;
+  std::vector<raytracer::FilmPixel> pixels;
+};
+
+// Written to a temporary file first, so an interrupted write never replaces
+// the previous checkpoint
+bool writeCheckpoint(const std::string &path, const RenderCheckpoint &checkpoint);
+bool readCheckpoint(const std::string &path, RenderCheckpoint &checkpoint);
@@ -0,0 +1,325 @@
+#include "io/image_io.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef RAYTRACER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using raytracer::Image;
+
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+void putBytes(Bytes &out, const void *data, size_t size) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  out.insert(out.end(), p, p + size);
+}
+
+void putString(Bytes &out, const char *s) { putBytes(out, s, std::strlen(s) + 1); }
+
+void putLE32(Bytes &out, uint32_t v) {
+  uint8_t b[4] = {uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)};
+  putBytes(out, b, 4);
+}
+
+void putLE64(Bytes &out, uint64_t v) {
+  putLE32(out, uint32_t(v));
+  putLE32(out, uint32_t(v >> 32));
+}
+
+void putBE32(Bytes &out, uint32_t v) {
+  uint8_t b[4] = {uint8_t(v >> 24), uint8_t(v >> 16), uint8_t(v >> 8), uint8_t(v)};
+  putBytes(out, b, 4);
+}
+
+void putFloatLE(Bytes &out, float f) {
+  uint32_t v;
+  std::memcpy(&v, &f, 4);
+  putLE32(out, v);
+}
+
+bool hasExtension(const std::string &path, const char *ext) {
+  size_t n = std::strlen(ext);
+  if (path.size() < n) {
+    return false;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (std::tolower(path[path.size() - n + i]) != ext[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool writeFile(const std::string &path, const Bytes &data) {
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file) {
+    std::cerr << "Open file failed: " << path << std::endl;
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    std::cerr << "Writing " << path << " failed" << std::endl;
+  }
+  return ok;
+}
+
+Bytes encodePPM(const Image &image) {
+  int w = image.getWidth(), h = image.getHeight();
+  char header[64];
+  int n = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", w, h);
+  Bytes out;
+  out.reserve(n + size_t(w) * h * 3);
+  putBytes(out, header, n);
+  const float *p = image.data()->e.data();
+  for (size_t i = 0; i < size_t(w) * h * 3; ++i) {
+    out.push_back(raytracer::quantize(p[i]));
+  }
+  return out;
+}
+
+// Rows bottom to top, the negative scale marks little endian data
+Bytes encodePFM(const Image &image) {
+  int w = image.getWidth(), h = image.getHeight();
+  char header[64];
+  int n = std::snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", w, h);
+  Bytes out;
+  out.reserve(n + size_t(w) * h * 12);
+  putBytes(out, header, n);
+  for (int y = h - 1; y >= 0; --y) {
+    for (int x = 0; x < w; ++x) {
+      for (int c = 0; c < 3; ++c) putFloatLE(out, image(x, y)[c]);
+    }
+  }
+  return out;
+}
+
+void putAttribute(Bytes &out, const char *name, const char *type, const Bytes &value) {
+  putString(out, name);
+  putString(out, type);
+  putLE32(out, value.size());
+  putBytes(out, value.data(), value.size());
+}
+
+// Single part scanline OpenEXR without compression, one line per block.
+// Channels are stored in alphabetical order, i.e. B, G, R.
+Bytes encodeEXR(const Image &image) {
+  int w = image.getWidth(), h = image.getHeight();
+  const uint32_t kFloat = 2;
+  Bytes out = {0x76, 0x2f, 0x31, 0x01};
+  putLE32(out, 2);
+
+  Bytes channels, box, value;
+  for (const char *name : {"B", "G", "R"}) {
+    putString(channels, name);
+    putLE32(channels, kFloat);
+    putLE32(channels, 0);  // pLinear and reserved
+    putLE32(channels, 1);  // x sampling
+    putLE32(channels, 1);  // y sampling
+  }
+  channels.push_back(0);
+  putAttribute(out, "channels", "chlist", channels);
+  putAttribute(out, "compression", "compression", Bytes{0});
+  for (uint32_t v : {0u, 0u, uint32_t(w - 1), uint32_t(h - 1)}) putLE32(box, v);
+  putAttribute(out, "dataWindow", "box2i", box);
+  putAttribute(out, "displayWindow", "box2i", box);
+  putAttribute(out, "lineOrder", "lineOrder", Bytes{0});
+  putFloatLE(value, 1.f);
+  putAttribute(out, "pixelAspectRatio", "float", value);
+  putAttribute(out, "screenWindowWidth", "float", value);
+  value.clear();
+  putFloatLE(value, 0.f);
+  putFloatLE(value, 0.f);
+  putAttribute(out, "screenWindowCenter", "v2f", value);
+  out.push_back(0);
+
+  uint32_t lineBytes = uint32_t(w) * 3 * 4;
+  uint64_t offset = out.size() + uint64_t(h) * 8;
+  out.reserve(offset + uint64_t(h) * (8 + lineBytes));
+  for (int y = 0; y < h; ++y) {
+    putLE64(out, offset + uint64_t(y) * (8 + lineBytes));
+  }
+  for (int y = 0; y < h; ++y) {
+    putLE32(out, y);
+    putLE32(out, lineBytes);
+    for (int c = 2; c >= 0; --c) {
+      for (int x = 0; x < w; ++x) putFloatLE(out, image(x, y)[c]);
+    }
+  }
+  return out;
+}
+
+#ifdef RAYTRACER_HAVE_ZLIB
+void putChunk(Bytes &out, const char *type, const uint8_t *data, size_t size) {
+  putBE32(out, size);
+  size_t start = out.size();
+  putBytes(out, type, 4);
+  putBytes(out, data, size);
+  uLong crc = crc32(0L, out.data() + start, size + 4);
+  putBE32(out, crc);
+}
+
+// 8 bit RGB with the Sub filter on every row, which is cheap and already
+// gets most of the gain on smooth renders
+bool encodePNG(const Image &image, Bytes &out) {
+  int w = image.getWidth(), h = image.getHeight();
+  size_t stride = size_t(w) * 3 + 1;
+  Bytes raw(stride * h);
+  for (int y = 0; y < h; ++y) {
+    uint8_t *row = &raw[y * stride];
+    row[0] = 1;
+    uint8_t prev[3] = {0, 0, 0};
+    const float *p = image(0, y).e.data();
+    for (int i = 0; i < w * 3; ++i) {
+      uint8_t v = raytracer::quantize(p[i]);
+      row[1 + i] = v - prev[i % 3];
+      prev[i % 3] = v;
+    }
+  }
+  uLongf compressedSize = compressBound(raw.size());
+  Bytes compressed(compressedSize);
+  if (compress2(compressed.data(), &compressedSize, raw.data(), raw.size(), Z_BEST_SPEED) !=
+      Z_OK) {
+    return false;
+  }
+
+  const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  out.clear();
+  out.reserve(compressedSize + 64);
+  putBytes(out, signature, 8);
+  Bytes ihdr;
+  putBE32(ihdr, w);
+  putBE32(ihdr, h);
+  // 8 bit depth, RGB, deflate, adaptive filtering, no interlace
+  ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+  putChunk(out, "IHDR", ihdr.data(), ihdr.size());
+  const size_t kMaxChunk = 1 << 24;
+  for (size_t i = 0; i < compressedSize; i += kMaxChunk) {
+    putChunk(out, "IDAT", compressed.data() + i, std::min(kMaxChunk, compressedSize - i));
+  }
+  putChunk(out, "IEND", nullptr, 0);
+  return true;
+}
+#endif
+
+}  // namespace
+
+bool writeImage(const std::string &path, const Image &image) {
+  if (image.empty()) {
+    std::cerr << "Cannot write empty image " << path << std::endl;
+    return false;
+  }
+  if (hasExtension(path, ".ppm")) {
+    return writeFile(path, encodePPM(image));
+  } else if (hasExtension(path, ".pfm")) {
+    return writeFile(path, encodePFM(image));
+  } else if (hasExtension(path, ".exr")) {
+    return writeFile(path, encodeEXR(image));
+  } else if (hasExtension(path, ".png")) {
+#ifdef RAYTRACER_HAVE_ZLIB
+    Bytes png;
+    if (!encodePNG(image, png)) {
+      std::cerr << "PNG encoding failed: " << path << std::endl;
+      return false;
+    }
+    return writeFile(path, png);
+#else
+    std::cerr << "Built without zlib, cannot write " << path << std::endl;
+    return false;
+#endif
+  }
+  std::cerr << "Unknown image format: " << path << std::endl;
+  return false;
+}
+
+bool readImage(const std::string &path, Image &image) {
+  if (!hasExtension(path, ".pfm")) {
+    std::cerr << "Only .pfm images can be read: " << path << std::endl;
+    return false;
+  }
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    std::cerr << "Open file failed: " << path << std::endl;
+    return false;
+  }
+  int w = 0, h = 0;
+  float scale = 0.f;
+  // A single whitespace character separates the header from the data
+  bool ok = std::fscanf(file, "PF %d %d %f", &w, &h, &scale) == 3 && std::fgetc(file) != EOF &&
+            w > 0 && h > 0 && scale != 0.f;
+  std::vector<uint8_t> data(ok ? size_t(w) * h * 12 : 0);
+  ok = ok && fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  if (!ok) {
+    std::cerr << "Not a color PFM image: " << path << std::endl;
+    return false;
+  }
+  image = Image(w, h);
+  const uint8_t *p = data.data();
+  for (int y = h - 1; y >= 0; --y) {
+    for (int x = 0; x < w; ++x) {
+      for (int c = 0; c < 3; ++c, p += 4) {
+        // A negative scale marks little endian data
+        uint32_t v = scale < 0.f ? p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24
+                                 : p[3] | p[2] << 8 | p[1] << 16 | uint32_t(p[0]) << 24;
+        std::memcpy(&image(x, y)[c], &v, 4);
+      }
+    }
+  }
+  return true;
+}
+
+AsyncImageWriter::AsyncImageWriter() : thread(&AsyncImageWriter::run, this) {}
+
+AsyncImageWriter::~AsyncImageWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  condition.notify_all();
+  thread.join();
+}
+
+void AsyncImageWriter::write(std::string path, Image image) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.emplace_back(std::move(path), std::move(image));
+  }
+  condition.notify_all();
+}
+
+bool AsyncImageWriter::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [this] { return queue.empty() && !busy; });
+  bool ok = !failed;
+  failed = false;
+  return ok;
+}
+
+void AsyncImageWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    condition.wait(lock, [this] { return stop || !queue.empty(); });
+    if (queue.empty()) {
+      // Only reached when stopping, everything queued has been written
+      return;
+    }
+    std::pair<std::string, Image> job = std::move(queue.front());
+    queue.pop_front();
+    busy = true;
+    lock.unlock();
+    bool ok = writeImage(job.first, job.second);
+    lock.lock();
+    busy = false;
+    failed = failed || !ok;
+    condition.notify_all();
+  }
+}
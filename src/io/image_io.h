@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "core/image.h"
+
+// Image output. The format follows the extension of the path:
+//   .ppm  binary P6, gamma 2, 8 bits
+//   .png  RGB 8 bits, gamma 2 (needs zlib)
+//   .exr  uncompressed 32 bit float scanlines, linear
+//   .pfm  portable float map, linear
+// Every writer encodes the whole image from memory and writes it in one go.
+bool writeImage(const std::string &path, const raytracer::Image &image);
+// Reads back a .pfm image, the only format that keeps the floats exactly
+bool readImage(const std::string &path, raytracer::Image &image);
+
+// Writes images on a background thread so rendering can go on while the
+// previous frame or preview is being encoded. Images are written in the
+// order they were queued, the destructor waits for all of them.
+class AsyncImageWriter {
+public:
+  AsyncImageWriter();
+  ~AsyncImageWriter();
+  AsyncImageWriter(const AsyncImageWriter &) = delete;
+  AsyncImageWriter &operator=(const AsyncImageWriter &) = delete;
+
+  void write(std::string path, raytracer::Image image);
+  // Block until everything queued so far is written. Returns false if any
+  // write failed since the last call.
+  bool wait();
+
+private:
+  void run();
+
+  std::deque<std::pair<std::string, raytracer::Image>> queue;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool busy = false, failed = false, stop = false;
+  std::thread thread;
+};
@@ -0,0 +1,302 @@
+#include "io/mesh_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "io/mesh_loader.h"
+
+namespace {
+
+const char kMagic[8] = {'R', 'T', 'M', 'E', 'S', 'H', '\0', '\0'};
+// Bump whenever the layout of the header or of any stored array changes
+const uint32_t kVersion = 3;
+const uint32_t kEndianMarker = 0x01020304;
+const uint64_t kAlignment = 64;
+
+enum Section {
+  kPositions,
+  kNormals,
+  kUVs,
+  kIndices,
+  kNodes,
+  kCompressedNodes,
+  kPrimIndices,
+  kNumSections
+};
+
+struct MeshCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endianMarker;
+  uint32_t splitMethod;
+  uint32_t layout;
+  uint32_t elementSizes[kNumSections];
+  uint64_t sourceSize;
+  int64_t sourceMtime;
+  uint64_t tagHash;
+  // Byte offset and element count of every array, offsets are aligned to kAlignment
+  uint64_t offsets[kNumSections];
+  uint64_t counts[kNumSections];
+};
+
+const uint32_t kElementSizes[kNumSections] = {
+    sizeof(vec3),          sizeof(vec3),              sizeof(Point2f),  sizeof(uint32_t),
+    sizeof(LinearBVHNode), sizeof(CompressedBVHNode), sizeof(uint32_t)};
+
+// FNV-1a, only to tell tags apart
+uint64_t hashTag(const std::string &tag) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : tag) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+bool getSourceStamp(const std::string &sourcePath, uint64_t &size, int64_t &mtime) {
+  size = 0;
+  mtime = 0;
+  if (sourcePath.empty()) {
+    return true;
+  }
+  struct stat st;
+  if (stat(sourcePath.c_str(), &st) != 0) {
+    return false;
+  }
+  size = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
+
+// Owns a private mapping of a whole file, unmapped once the last buffer
+// viewing it is gone
+class MappedFile {
+public:
+  MappedFile(void *data, size_t size) : data(data), size(size) {}
+  ~MappedFile() { munmap(data, size); }
+  void *data;
+  size_t size;
+};
+
+template <typename T>
+raytracer::Buffer<T> viewSection(const sPtr<MappedFile> &file, const MeshCacheHeader &header,
+                                 Section section) {
+  T *ptr = reinterpret_cast<T *>(static_cast<char *>(file->data) + header.offsets[section]);
+  return raytracer::Buffer<T>(ptr, header.counts[section], file);
+}
+
+// Whether the mapped mesh and tree are consistent, so that a corrupt cache is
+// rebuilt instead of sending traversal out of its arrays. Children always come
+// after their parent in both layouts, which bounds the walk, and the depth is
+// bounded by the traversal stacks.
+bool validCache(const TriangleMesh &mesh, const raytracer::Buffer<LinearBVHNode> &nodes,
+                const raytracer::Buffer<CompressedBVHNode> &compressedNodes,
+                const raytracer::Buffer<uint32_t> &primIndices, BVHLayout layout) {
+  const size_t nVertices = mesh.p.size(), nTriangles = mesh.indices.size() / 3;
+  const size_t nPrimitives = primIndices.size();
+  const int kMaxDepth = 64;
+  if (mesh.indices.size() % 3 != 0 || (!mesh.n.empty() && mesh.n.size() != nVertices) ||
+      (!mesh.uv.empty() && mesh.uv.size() != nVertices)) {
+    return false;
+  }
+  for (uint32_t index : mesh.indices) {
+    if (index >= nVertices) return false;
+  }
+  for (uint32_t triangle : primIndices) {
+    if (triangle >= nTriangles) return false;
+  }
+  // A leaf covers primitives [first, first + count)
+  auto validLeaf = [&](int64_t first, int64_t count) {
+    return first >= 0 && first + count <= int64_t(nPrimitives);
+  };
+  if (layout == BVHLayout::Compressed) {
+    std::vector<uint8_t> depth(compressedNodes.size(), 0);
+    for (size_t i = 0; i < compressedNodes.size(); ++i) {
+      const CompressedBVHNode &node = compressedNodes[i];
+      if (node.nChildren > 4) return false;
+      for (int c = 0; c < node.nChildren; ++c) {
+        if (node.nPrimitives[c] > 0) {
+          if (!validLeaf(node.child[c], node.nPrimitives[c])) return false;
+        } else if (node.child[c] <= i || node.child[c] >= compressedNodes.size() ||
+                   depth[i] + 1 >= kMaxDepth) {
+          return false;
+        } else {
+          depth[node.child[c]] = std::max<int>(depth[node.child[c]], depth[i] + 1);
+        }
+      }
+    }
+  } else {
+    std::vector<uint8_t> depth(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      const LinearBVHNode &node = nodes[i];
+      if (node.nPrimitives > 0) {
+        if (!validLeaf(node.primitivesOffset, node.nPrimitives)) return false;
+        continue;
+      }
+      // The first child follows its parent, the second is anywhere after it
+      size_t second = node.secondChildOffset;
+      if (node.secondChildOffset <= int64_t(i) + 1 || second >= nodes.size() ||
+          node.axis > 2 || depth[i] + 1 >= kMaxDepth) {
+        return false;
+      }
+      depth[i + 1] = std::max<int>(depth[i + 1], depth[i] + 1);
+      depth[second] = std::max<int>(depth[second], depth[i] + 1);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool writeMeshCache(const std::string &path, const BVH &bvh, const std::string &sourcePath,
+                    const std::string &tag) {
+  const sPtr<const TriangleMesh> &mesh = bvh.getMesh();
+  if (!mesh) {
+    std::cerr << "Only mesh BVHs can be cached" << std::endl;
+    return false;
+  }
+  MeshCacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.endianMarker = kEndianMarker;
+  header.splitMethod = static_cast<uint32_t>(bvh.getSplitMethod());
+  header.layout = static_cast<uint32_t>(bvh.getLayout());
+  std::memcpy(header.elementSizes, kElementSizes, sizeof(kElementSizes));
+  header.tagHash = hashTag(tag);
+  if (!getSourceStamp(sourcePath, header.sourceSize, header.sourceMtime)) {
+    std::cerr << "Cannot stat " << sourcePath << std::endl;
+    return false;
+  }
+  const void *arrays[kNumSections] = {
+      mesh->p.data(),        mesh->n.data(),
+      mesh->uv.data(),       mesh->indices.data(),
+      bvh.getNodes().data(), bvh.getCompressedNodes().data(),
+      bvh.getPrimIndices().data()};
+  header.counts[kPositions] = mesh->p.size();
+  header.counts[kNormals] = mesh->n.size();
+  header.counts[kUVs] = mesh->uv.size();
+  header.counts[kIndices] = mesh->indices.size();
+  header.counts[kNodes] = bvh.getNodes().size();
+  header.counts[kCompressedNodes] = bvh.getCompressedNodes().size();
+  header.counts[kPrimIndices] = bvh.getPrimIndices().size();
+  uint64_t offset = sizeof(header);
+  for (int i = 0; i < kNumSections; ++i) {
+    offset = (offset + kAlignment - 1) / kAlignment * kAlignment;
+    header.offsets[i] = offset;
+    offset += header.counts[i] * kElementSizes[i];
+  }
+
+  // Write to a temporary file and rename it, so that a concurrent or
+  // interrupted run never maps a half written cache
+  std::string tmpPath = path + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "wb");
+  if (!file) {
+    std::cerr << "Open file failed: " << tmpPath << std::endl;
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  uint64_t written = sizeof(header);
+  static const char zeros[kAlignment] = {};
+  for (int i = 0; i < kNumSections && ok; ++i) {
+    ok = fwrite(zeros, 1, header.offsets[i] - written, file) == header.offsets[i] - written;
+    size_t bytes = header.counts[i] * kElementSizes[i];
+    ok = ok && (bytes == 0 || fwrite(arrays[i], 1, bytes, file) == bytes);
+    written = header.offsets[i] + bytes;
+  }
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::cerr << "Writing mesh cache " << path << " failed" << std::endl;
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+sPtr<BVH> mapMeshCache(const std::string &path, material *mat, const std::string &sourcePath,
+                       const std::string &tag) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(MeshCacheHeader)) {
+    close(fd);
+    return nullptr;
+  }
+  // A private writable mapping lets the mesh be edited in place after
+  // loading without ever writing back to the cache
+  void *data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  sPtr<MappedFile> file = mkS<MappedFile>(data, st.st_size);
+
+  const MeshCacheHeader &header = *static_cast<const MeshCacheHeader *>(data);
+  uint64_t sourceSize;
+  int64_t sourceMtime;
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+      header.endianMarker != kEndianMarker ||
+      std::memcmp(header.elementSizes, kElementSizes, sizeof(kElementSizes)) != 0 ||
+      !getSourceStamp(sourcePath, sourceSize, sourceMtime) || sourceSize != header.sourceSize ||
+      sourceMtime != header.sourceMtime || header.tagHash != hashTag(tag)) {
+    return nullptr;
+  }
+  // Every section within the file, without overflowing on huge counts
+  for (int i = 0; i < kNumSections; ++i) {
+    if (header.offsets[i] % kAlignment != 0 || header.offsets[i] > file->size ||
+        header.counts[i] > (file->size - header.offsets[i]) / kElementSizes[i]) {
+      std::cerr << "Mesh cache " << path << " is truncated" << std::endl;
+      return nullptr;
+    }
+  }
+  if (header.layout != uint32_t(BVHLayout::Full) &&
+      header.layout != uint32_t(BVHLayout::Compressed)) {
+    return nullptr;
+  }
+
+  sPtr<TriangleMesh> mesh = mkS<TriangleMesh>();
+  mesh->p = viewSection<vec3>(file, header, kPositions);
+  mesh->n = viewSection<vec3>(file, header, kNormals);
+  mesh->uv = viewSection<Point2f>(file, header, kUVs);
+  mesh->indices = viewSection<uint32_t>(file, header, kIndices);
+  mesh->mat = mat;
+  auto nodes = viewSection<LinearBVHNode>(file, header, kNodes);
+  auto compressedNodes = viewSection<CompressedBVHNode>(file, header, kCompressedNodes);
+  auto primIndices = viewSection<uint32_t>(file, header, kPrimIndices);
+  BVHLayout layout = static_cast<BVHLayout>(header.layout);
+  if (!validCache(*mesh, nodes, compressedNodes, primIndices, layout)) {
+    std::cerr << "Mesh cache " << path << " is corrupt" << std::endl;
+    return nullptr;
+  }
+  return mkS<BVH>(mesh, std::move(nodes), std::move(compressedNodes), std::move(primIndices),
+                  static_cast<SplitMethod>(header.splitMethod), layout);
+}
+
+sPtr<BVH> loadMeshCached(const std::string &meshPath, const std::string &cachePath,
+                         material *mat, SplitMethod sp,
+                         const std::function<void(TriangleMesh &)> &prepare,
+                         const std::string &prepareTag, BVHLayout layout) {
+  sPtr<BVH> bvh = mapMeshCache(cachePath, mat, meshPath, prepareTag);
+  if (bvh && bvh->getSplitMethod() == sp && bvh->getLayout() == layout) {
+    return bvh;
+  }
+  sPtr<TriangleMesh> mesh = loadMesh(meshPath, mat);
+  if (!mesh) {
+    return nullptr;
+  }
+  if (prepare) {
+    prepare(*mesh);
+  }
+  bvh = mkS<BVH>(mesh, sp, layout);
+  writeMeshCache(cachePath, *bvh, meshPath, prepareTag);
+  return bvh;
+}
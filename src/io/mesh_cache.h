@@ -0,0 +1,35 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "accelerators/bvh.h"
+
+// Versioned binary cache of a triangle mesh together with its flattened BVH,
+// in whichever node layout it was built with.
+// Every array is stored exactly as it is laid out in memory, so loading is a
+// single mmap: the mesh and the BVH become views of the mapped pages with no
+// parsing and no pointer fix-ups, and pages are only read in as rays touch them.
+//
+// Materials are not part of the cache, they are passed in when mapping.
+// When sourcePath is given, its size and modification time are recorded and a
+// cache whose source has changed since is rejected. tag names whatever else
+// the cached geometry depends on, a cache written with another tag is
+// rejected too.
+
+bool writeMeshCache(const std::string &path, const BVH &bvh, const std::string &sourcePath = "",
+                    const std::string &tag = "");
+// Returns nullptr when the cache is missing, stale or written by another version
+sPtr<BVH> mapMeshCache(const std::string &path, material *mat, const std::string &sourcePath = "",
+                       const std::string &tag = "");
+
+// Map cachePath when it is up to date with meshPath and was built with the
+// same split method, layout and prepareTag. Otherwise load the mesh, run
+// prepare on it (e.g. to transform the vertices), build the BVH and write the
+// cache for the next run. prepareTag identifies prepare and has to change
+// whenever prepare does, or the geometry of the old one is mapped.
+sPtr<BVH> loadMeshCached(const std::string &meshPath, const std::string &cachePath,
+                         material *mat, SplitMethod sp = SplitMethod::SAH,
+                         const std::function<void(TriangleMesh &)> &prepare = nullptr,
+                         const std::string &prepareTag = "",
+                         BVHLayout layout = BVHLayout::Full);
@@ -0,0 +1,753 @@
+#include "io/mesh_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "core/parallel.h"
+
+namespace {
+
+// Size of the pieces the input is split into for parallel parsing
+constexpr size_t kChunkSize = 1 << 20;
+constexpr uint32_t kNoIndex = UINT32_MAX;
+constexpr size_t kPadding = 8;
+
+bool readFile(const std::string &path, std::vector<char> &data) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    std::cerr << "Open file failed: " << path << std::endl;
+    return false;
+  }
+  std::streamsize size = file.tellg();
+  file.seekg(0);
+  // The trailing newlines guarantee every number and line scan terminates
+  // without checking for the end of the buffer, and leave room for reading
+  // a binary value past the end of a truncated file
+  data.assign(size + kPadding, '\n');
+  file.read(data.data(), size);
+  return true;
+}
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+inline void skipSpaces(const char *&s) {
+  while (isSpace(*s)) ++s;
+}
+inline void skipLine(const char *&s) {
+  while (*s != '\n') ++s;
+  ++s;
+}
+
+// Hand written replacement for strtof, which goes through the locale and is
+// several times slower. The mantissa is accumulated as an integer and scaled
+// once, which is exact for the usual number of digits in mesh files.
+float parseFloat(const char *&s) {
+  static const double powersOf10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                      1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                      1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  constexpr uint64_t kMaxMantissa = 100000000000000000ull;
+  skipSpaces(s);
+  bool negative = *s == '-';
+  if (*s == '-' || *s == '+') ++s;
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  for (; isDigit(*s); ++s) {
+    if (mantissa < kMaxMantissa) {
+      mantissa = mantissa * 10 + (*s - '0');
+    } else {
+      exponent++;
+    }
+  }
+  if (*s == '.') {
+    for (++s; isDigit(*s); ++s) {
+      if (mantissa < kMaxMantissa) {
+        mantissa = mantissa * 10 + (*s - '0');
+        exponent--;
+      }
+    }
+  }
+  if (*s == 'e' || *s == 'E') {
+    ++s;
+    bool negativeExp = *s == '-';
+    if (*s == '-' || *s == '+') ++s;
+    int e = 0;
+    for (; isDigit(*s); ++s) e = std::min(e * 10 + (*s - '0'), 1000);
+    exponent += negativeExp ? -e : e;
+  }
+  double value = static_cast<double>(mantissa);
+  if (exponent != 0 && mantissa != 0) {
+    int absExp = std::abs(exponent);
+    double scale = absExp <= 22 ? powersOf10[absExp] : std::pow(10.0, absExp);
+    value = exponent < 0 ? value / scale : value * scale;
+  }
+  return static_cast<float>(negative ? -value : value);
+}
+
+int64_t parseInt(const char *&s) {
+  skipSpaces(s);
+  bool negative = *s == '-';
+  if (*s == '-' || *s == '+') ++s;
+  int64_t value = 0;
+  for (; isDigit(*s); ++s) value = value * 10 + (*s - '0');
+  return negative ? -value : value;
+}
+
+// Split [begin, end) into pieces of about kChunkSize that all end on a line break
+std::vector<std::pair<const char *, const char *>> splitLines(const char *begin,
+                                                              const char *end) {
+  std::vector<std::pair<const char *, const char *>> chunks;
+  while (begin < end) {
+    const char *chunkEnd = begin + std::min(kChunkSize, static_cast<size_t>(end - begin));
+    while (chunkEnd < end && chunkEnd[-1] != '\n') ++chunkEnd;
+    chunks.emplace_back(begin, chunkEnd);
+    begin = chunkEnd;
+  }
+  return chunks;
+}
+
+void parallelChunks(int nChunks, const std::function<void(int)> &func) {
+  raytracer::ParallelFor(func, nChunks, 1);
+}
+
+// Resolve per corner attribute indices against the position indices. When
+// every position is always paired with the same attribute the attribute is
+// simply moved to the slot of the position, otherwise false is returned and
+// the mesh has to be de-indexed.
+template <typename T>
+bool remapAttribute(const std::vector<uint32_t> &vIdx, const std::vector<uint32_t> &attrIdx,
+                    size_t nPositions, std::vector<T> &attr, T fallback) {
+  std::vector<uint32_t> mapping(nPositions, kNoIndex);
+  for (size_t i = 0; i < vIdx.size(); ++i) {
+    uint32_t &m = mapping[vIdx[i]];
+    if (attrIdx[i] == kNoIndex) {
+      continue;
+    } else if (m == kNoIndex) {
+      m = attrIdx[i];
+    } else if (m != attrIdx[i]) {
+      return false;
+    }
+  }
+  std::vector<T> remapped(nPositions, fallback);
+  for (size_t i = 0; i < nPositions; ++i) {
+    if (mapping[i] != kNoIndex) remapped[i] = attr[mapping[i]];
+  }
+  attr.swap(remapped);
+  return true;
+}
+
+template <typename T>
+void deindexAttribute(const std::vector<uint32_t> &idx, std::vector<T> &attr, T fallback) {
+  std::vector<T> expanded(idx.size());
+  int nChunks = (idx.size() + kChunkSize - 1) / kChunkSize;
+  parallelChunks(nChunks, [&](int c) {
+    size_t end = std::min(idx.size(), (c + 1) * kChunkSize);
+    for (size_t i = c * kChunkSize; i < end; ++i) {
+      expanded[i] = idx[i] == kNoIndex ? fallback : attr[idx[i]];
+    }
+  });
+  attr.swap(expanded);
+}
+
+struct ObjChunk {
+  const char *begin, *end;
+  size_t nPositions = 0, nNormals = 0, nUVs = 0, nTriangles = 0;
+  // Offsets of this chunk in the output buffers, filled by a prefix sum
+  size_t positionOffset = 0, normalOffset = 0, uvOffset = 0, triangleOffset = 0;
+};
+
+// Resolve a 1 based, possibly negative (relative) OBJ index
+inline uint32_t resolveObjIndex(int64_t idx, size_t count, std::atomic<bool> &valid) {
+  int64_t resolved = idx > 0 ? idx - 1 : static_cast<int64_t>(count) + idx;
+  if (idx == 0 || resolved < 0 || resolved >= static_cast<int64_t>(count)) {
+    valid = false;
+    return 0;
+  }
+  return static_cast<uint32_t>(resolved);
+}
+
+}  // namespace
+
+sPtr<TriangleMesh> loadOBJ(const std::string &path, material *mat) {
+  std::vector<char> data;
+  if (!readFile(path, data)) {
+    return nullptr;
+  }
+  auto ranges = splitLines(data.data(), data.data() + data.size() - kPadding + 1);
+  std::vector<ObjChunk> chunks(ranges.size());
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    chunks[i].begin = ranges[i].first;
+    chunks[i].end = ranges[i].second;
+  }
+
+  // First pass, count the elements of every chunk
+  parallelChunks(chunks.size(), [&](int c) {
+    ObjChunk &chunk = chunks[c];
+    const char *s = chunk.begin;
+    while (s < chunk.end) {
+      skipSpaces(s);
+      if (s[0] == 'v') {
+        if (isSpace(s[1])) {
+          chunk.nPositions++;
+        } else if (s[1] == 'n') {
+          chunk.nNormals++;
+        } else if (s[1] == 't') {
+          chunk.nUVs++;
+        }
+      } else if (s[0] == 'f' && isSpace(s[1])) {
+        int nCorners = 0;
+        ++s;
+        while (true) {
+          skipSpaces(s);
+          if (*s == '\n' || *s == '#') break;
+          nCorners++;
+          while (!isSpace(*s) && *s != '\n') ++s;
+        }
+        chunk.nTriangles += std::max(0, nCorners - 2);
+      }
+      skipLine(s);
+    }
+  });
+
+  size_t nPositions = 0, nNormals = 0, nUVs = 0, nTriangles = 0;
+  for (ObjChunk &chunk : chunks) {
+    chunk.positionOffset = nPositions;
+    chunk.normalOffset = nNormals;
+    chunk.uvOffset = nUVs;
+    chunk.triangleOffset = nTriangles;
+    nPositions += chunk.nPositions;
+    nNormals += chunk.nNormals;
+    nUVs += chunk.nUVs;
+    nTriangles += chunk.nTriangles;
+  }
+  if (nTriangles == 0 || nPositions >= kNoIndex) {
+    std::cerr << "No triangles to load in " << path << std::endl;
+    return nullptr;
+  }
+
+  std::vector<vec3> positions(nPositions), normals(nNormals);
+  std::vector<Point2f> uvs(nUVs);
+  std::vector<uint32_t> vIdx(3 * nTriangles), vtIdx, vnIdx;
+  if (nUVs > 0) vtIdx.resize(3 * nTriangles);
+  if (nNormals > 0) vnIdx.resize(3 * nTriangles);
+  std::atomic<bool> valid(true);
+
+  // Second pass, parse every chunk straight into its slice of the buffers
+  parallelChunks(chunks.size(), [&](int c) {
+    const ObjChunk &chunk = chunks[c];
+    size_t iP = chunk.positionOffset, iN = chunk.normalOffset, iUV = chunk.uvOffset;
+    size_t corner = 3 * chunk.triangleOffset;
+    const char *s = chunk.begin;
+    while (s < chunk.end) {
+      skipSpaces(s);
+      if (s[0] == 'v' && isSpace(s[1])) {
+        s += 1;
+        float x = parseFloat(s), y = parseFloat(s), z = parseFloat(s);
+        positions[iP++] = vec3(x, y, z);
+      } else if (s[0] == 'v' && s[1] == 'n') {
+        s += 2;
+        float x = parseFloat(s), y = parseFloat(s), z = parseFloat(s);
+        normals[iN++] = vec3(x, y, z);
+      } else if (s[0] == 'v' && s[1] == 't') {
+        s += 2;
+        float u = parseFloat(s);
+        skipSpaces(s);
+        float v = *s == '\n' ? 0.f : parseFloat(s);
+        uvs[iUV++] = Point2f(u, v);
+      } else if (s[0] == 'f' && isSpace(s[1])) {
+        ++s;
+        uint32_t first[3], prev[3], cur[3];
+        int nCorners = 0;
+        while (true) {
+          skipSpaces(s);
+          if (*s == '\n' || *s == '#') break;
+          cur[0] = resolveObjIndex(parseInt(s), iP, valid);
+          cur[1] = cur[2] = kNoIndex;
+          if (*s == '/') {
+            ++s;
+            if (*s != '/') cur[1] = resolveObjIndex(parseInt(s), iUV, valid);
+            if (*s == '/') {
+              ++s;
+              cur[2] = resolveObjIndex(parseInt(s), iN, valid);
+            }
+          }
+          while (!isSpace(*s) && *s != '\n') ++s;
+          if (nCorners == 0) {
+            std::copy(cur, cur + 3, first);
+          } else if (nCorners >= 2) {
+            // Fan triangulation around the first corner
+            const uint32_t *triangle[3] = {first, prev, cur};
+            for (int k = 0; k < 3; ++k, ++corner) {
+              vIdx[corner] = triangle[k][0];
+              if (!vtIdx.empty()) vtIdx[corner] = triangle[k][1];
+              if (!vnIdx.empty()) vnIdx[corner] = triangle[k][2];
+            }
+          }
+          std::copy(cur, cur + 3, prev);
+          nCorners++;
+        }
+      }
+      skipLine(s);
+    }
+  });
+  if (!valid) {
+    std::cerr << "Invalid face index in " << path << std::endl;
+    return nullptr;
+  }
+
+  // Normals and uvs have their own indices in OBJ. Share the position index
+  // when the file allows it, otherwise give every corner its own vertex.
+  bool uvShared = vtIdx.empty() || remapAttribute(vIdx, vtIdx, nPositions, uvs, Point2f(0, 0));
+  bool normalShared = vnIdx.empty() || remapAttribute(vIdx, vnIdx, nPositions, normals, vec3(0.f));
+  if (!uvShared || !normalShared) {
+    if (!vtIdx.empty()) deindexAttribute(uvShared ? vIdx : vtIdx, uvs, Point2f(0, 0));
+    if (!vnIdx.empty()) deindexAttribute(normalShared ? vIdx : vnIdx, normals, vec3(0.f));
+    deindexAttribute(vIdx, positions, vec3(0.f));
+    for (size_t i = 0; i < vIdx.size(); ++i) vIdx[i] = i;
+  }
+  return mkS<TriangleMesh>(std::move(positions), std::move(vIdx), mat, std::move(normals),
+                           std::move(uvs));
+}
+
+namespace {
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+struct PlyProperty {
+  std::string name;
+  PlyType type, countType = PlyType::Invalid;
+  bool isList = false;
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> props;
+  // Size of one element in binary files, -1 when it has list properties
+  int stride = 0;
+};
+
+PlyType parsePlyType(const std::string &name) {
+  if (name == "char" || name == "int8") return PlyType::Int8;
+  if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+  if (name == "short" || name == "int16") return PlyType::Int16;
+  if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+  if (name == "int" || name == "int32") return PlyType::Int32;
+  if (name == "uint" || name == "uint32") return PlyType::UInt32;
+  if (name == "float" || name == "float32") return PlyType::Float32;
+  if (name == "double" || name == "float64") return PlyType::Float64;
+  return PlyType::Invalid;
+}
+
+int plyTypeSize(PlyType type) {
+  switch (type) {
+    case PlyType::Int8:
+    case PlyType::UInt8:
+      return 1;
+    case PlyType::Int16:
+    case PlyType::UInt16:
+      return 2;
+    case PlyType::Int32:
+    case PlyType::UInt32:
+    case PlyType::Float32:
+      return 4;
+    case PlyType::Float64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+template <typename T>
+inline T readRaw(const char *p, bool swap) {
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, p, sizeof(T));
+  if (swap) std::reverse(bytes, bytes + sizeof(T));
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+double readBinary(const char *p, PlyType type, bool swap) {
+  switch (type) {
+    case PlyType::Int8:
+      return readRaw<int8_t>(p, false);
+    case PlyType::UInt8:
+      return readRaw<uint8_t>(p, false);
+    case PlyType::Int16:
+      return readRaw<int16_t>(p, swap);
+    case PlyType::UInt16:
+      return readRaw<uint16_t>(p, swap);
+    case PlyType::Int32:
+      return readRaw<int32_t>(p, swap);
+    case PlyType::UInt32:
+      return readRaw<uint32_t>(p, swap);
+    case PlyType::Float32:
+      return readRaw<float>(p, swap);
+    case PlyType::Float64:
+      return readRaw<double>(p, swap);
+    default:
+      return 0.0;
+  }
+}
+
+// Byte size of one binary element starting at p
+size_t binaryElementSize(const PlyElement &elem, const char *p, bool swap) {
+  if (elem.stride >= 0) return elem.stride;
+  size_t size = 0;
+  for (const PlyProperty &prop : elem.props) {
+    if (prop.isList) {
+      size_t count = readBinary(p + size, prop.countType, swap);
+      size += plyTypeSize(prop.countType) + count * plyTypeSize(prop.type);
+    } else {
+      size += plyTypeSize(prop.type);
+    }
+  }
+  return size;
+}
+
+// Vertex attributes the mesh understands, by property name
+enum PlyRole { kX, kY, kZ, kNX, kNY, kNZ, kU, kV, kNumRoles };
+
+int plyRole(const std::string &name) {
+  if (name == "x") return kX;
+  if (name == "y") return kY;
+  if (name == "z") return kZ;
+  if (name == "nx") return kNX;
+  if (name == "ny") return kNY;
+  if (name == "nz") return kNZ;
+  if (name == "u" || name == "s" || name == "texture_u" || name == "texture_s") return kU;
+  if (name == "v" || name == "t" || name == "texture_v" || name == "texture_t") return kV;
+  return -1;
+}
+
+struct PlyChunk {
+  const char *begin, *end;
+  // First element of the chunk, counted over all elements of the file
+  size_t firstItem = 0, nItems = 0;
+  size_t nTriangles = 0, triangleOffset = 0;
+};
+
+}  // namespace
+
+sPtr<TriangleMesh> loadPLY(const std::string &path, material *mat) {
+  std::vector<char> data;
+  if (!readFile(path, data)) {
+    return nullptr;
+  }
+  const char *end = data.data() + data.size() - kPadding;
+
+  // The header is plain text in all variants of the format
+  const char *headerEnd = nullptr;
+  static const char kEndHeader[] = "end_header";
+  for (const char *s = data.data(); s < end; skipLine(s)) {
+    if (std::strncmp(s, kEndHeader, sizeof(kEndHeader) - 1) == 0) {
+      headerEnd = s;
+      skipLine(headerEnd);
+      break;
+    }
+  }
+  if (data.size() < 4 || std::strncmp(data.data(), "ply", 3) != 0 || !headerEnd) {
+    std::cerr << "Invalid ply header in " << path << std::endl;
+    return nullptr;
+  }
+
+  bool binary = false, swap = false;
+  std::vector<PlyElement> elements;
+  std::istringstream header(std::string(static_cast<const char *>(data.data()), headerEnd));
+  std::string line;
+  while (std::getline(header, line)) {
+    std::istringstream tokens(line);
+    std::string keyword;
+    tokens >> keyword;
+    if (keyword == "format") {
+      std::string format;
+      tokens >> format;
+      binary = format != "ascii";
+      swap = format == "binary_big_endian";
+    } else if (keyword == "element") {
+      PlyElement elem;
+      tokens >> elem.name >> elem.count;
+      elements.push_back(elem);
+    } else if (keyword == "property" && !elements.empty()) {
+      PlyProperty prop;
+      std::string type;
+      tokens >> type;
+      if (type == "list") {
+        std::string countType;
+        tokens >> countType >> type;
+        prop.isList = true;
+        prop.countType = parsePlyType(countType);
+      }
+      prop.type = parsePlyType(type);
+      tokens >> prop.name;
+      if (prop.type == PlyType::Invalid || (prop.isList && prop.countType == PlyType::Invalid)) {
+        std::cerr << "Unknown ply property type in " << path << ": " << line << std::endl;
+        return nullptr;
+      }
+      PlyElement &elem = elements.back();
+      elem.stride = prop.isList || elem.stride < 0 ? -1 : elem.stride + plyTypeSize(prop.type);
+      elem.props.push_back(prop);
+    }
+  }
+
+  int vertexElem = -1, faceElem = -1, faceList = -1;
+  int roles[kNumRoles];
+  std::fill(roles, roles + kNumRoles, -1);
+  // Role of each vertex property, kNumRoles for the ones that are skipped
+  std::vector<int> propRoles;
+  for (size_t e = 0; e < elements.size(); ++e) {
+    if (elements[e].name == "vertex") {
+      vertexElem = e;
+      propRoles.assign(elements[e].props.size(), kNumRoles);
+      for (size_t i = 0; i < elements[e].props.size(); ++i) {
+        int role = plyRole(elements[e].props[i].name);
+        if (role >= 0 && !elements[e].props[i].isList) {
+          roles[role] = i;
+          propRoles[i] = role;
+        }
+      }
+    } else if (elements[e].name == "face") {
+      faceElem = e;
+      for (size_t i = 0; i < elements[e].props.size(); ++i) {
+        const PlyProperty &prop = elements[e].props[i];
+        if (prop.isList && (prop.name == "vertex_indices" || prop.name == "vertex_index")) {
+          faceList = i;
+        }
+      }
+    }
+  }
+  if (vertexElem < 0 || faceElem < 0 || faceList < 0 || roles[kX] < 0 || roles[kY] < 0 ||
+      roles[kZ] < 0) {
+    std::cerr << "Ply file " << path << " has no triangle mesh" << std::endl;
+    return nullptr;
+  }
+  const PlyElement &vertices = elements[vertexElem], &faces = elements[faceElem];
+  if (vertices.count >= kNoIndex) {
+    std::cerr << "Too many vertices in " << path << std::endl;
+    return nullptr;
+  }
+  bool hasNormals = roles[kNX] >= 0 && roles[kNY] >= 0 && roles[kNZ] >= 0;
+  bool hasUVs = roles[kU] >= 0 && roles[kV] >= 0;
+
+  // Split the body into chunks, each one covering a run of elements. Binary
+  // files are walked once to find the element boundaries, ascii files are
+  // split on line breaks and the lines are counted.
+  std::vector<PlyChunk> chunks;
+  std::vector<size_t> elementStart(elements.size() + 1, 0);
+  for (size_t e = 0; e < elements.size(); ++e) {
+    elementStart[e + 1] = elementStart[e] + elements[e].count;
+  }
+  if (binary) {
+    const char *s = headerEnd;
+    size_t item = 0;
+    bool truncated = false;
+    for (const PlyElement &elem : elements) {
+      if (elem.stride >= 0) {
+        size_t perChunk = std::max<size_t>(1, kChunkSize / std::max(1, elem.stride));
+        for (size_t i = 0; i < elem.count; i += perChunk) {
+          PlyChunk chunk;
+          chunk.begin = s;
+          chunk.firstItem = item + i;
+          chunk.nItems = std::min(perChunk, elem.count - i);
+          s += chunk.nItems * elem.stride;
+          chunk.end = s;
+          chunks.push_back(chunk);
+        }
+      } else {
+        PlyChunk chunk;
+        chunk.begin = s;
+        chunk.firstItem = item;
+        for (size_t i = 0; i < elem.count && !truncated; ++i) {
+          truncated = s >= end;
+          s += binaryElementSize(elem, s, swap);
+          chunk.nItems++;
+          if (s - chunk.begin >= static_cast<ptrdiff_t>(kChunkSize) || i + 1 == elem.count) {
+            chunk.end = s;
+            chunks.push_back(chunk);
+            chunk = PlyChunk();
+            chunk.begin = s;
+            chunk.firstItem = item + i + 1;
+          }
+        }
+      }
+      item += elem.count;
+    }
+    if (truncated || s > end) {
+      std::cerr << "Unexpected end of file in " << path << std::endl;
+      return nullptr;
+    }
+  } else {
+    for (const auto &range : splitLines(headerEnd, end + 1)) {
+      PlyChunk chunk;
+      chunk.begin = range.first;
+      chunk.end = range.second;
+      chunks.push_back(chunk);
+    }
+    parallelChunks(chunks.size(), [&](int c) {
+      chunks[c].nItems = std::count(chunks[c].begin, chunks[c].end, '\n');
+    });
+    size_t item = 0;
+    for (PlyChunk &chunk : chunks) {
+      chunk.firstItem = item;
+      item += chunk.nItems;
+    }
+  }
+
+  // Walk every element of the file in a chunk, calling the callback with the
+  // element index, its local item index and a pointer to its data
+  auto forEachItem = [&](const PlyChunk &chunk, auto &&func) {
+    const char *s = chunk.begin;
+    int e = std::upper_bound(elementStart.begin(), elementStart.end(), chunk.firstItem) -
+            elementStart.begin() - 1;
+    for (size_t item = chunk.firstItem; item < chunk.firstItem + chunk.nItems; ++item) {
+      while (e < static_cast<int>(elements.size()) && item >= elementStart[e + 1]) ++e;
+      if (e >= static_cast<int>(elements.size())) return;
+      const char *next = s;
+      if (binary) {
+        next += binaryElementSize(elements[e], s, swap);
+      } else {
+        skipLine(next);
+      }
+      if (!func(e, item - elementStart[e], s)) return;
+      s = next;
+    }
+  };
+
+  // Count the triangles of every chunk
+  parallelChunks(chunks.size(), [&](int c) {
+    forEachItem(chunks[c], [&](int e, size_t, const char *&s) {
+      if (e != faceElem) return e < faceElem;
+      for (int i = 0; i <= faceList; ++i) {
+        const PlyProperty &prop = faces.props[i];
+        size_t count = 1;
+        if (prop.isList) {
+          if (binary) {
+            count = readBinary(s, prop.countType, swap);
+            s += plyTypeSize(prop.countType);
+          } else {
+            count = parseInt(s);
+          }
+        }
+        if (i == faceList) {
+          chunks[c].nTriangles += count >= 3 ? count - 2 : 0;
+          break;
+        }
+        if (binary) {
+          s += count * plyTypeSize(prop.type);
+        } else {
+          for (size_t k = 0; k < count; ++k) parseFloat(s);
+        }
+      }
+      return true;
+    });
+  });
+  size_t nTriangles = 0;
+  for (PlyChunk &chunk : chunks) {
+    chunk.triangleOffset = nTriangles;
+    nTriangles += chunk.nTriangles;
+  }
+  if (nTriangles == 0) {
+    std::cerr << "No triangles to load in " << path << std::endl;
+    return nullptr;
+  }
+
+  sPtr<TriangleMesh> mesh = mkS<TriangleMesh>();
+  mesh->mat = mat;
+  mesh->p.resize(vertices.count);
+  if (hasNormals) mesh->n.resize(vertices.count);
+  if (hasUVs) mesh->uv.resize(vertices.count, Point2f(0.f, 0.f));
+  mesh->indices.resize(3 * nTriangles);
+  std::atomic<bool> valid(true);
+
+  parallelChunks(chunks.size(), [&](int c) {
+    size_t corner = 3 * chunks[c].triangleOffset;
+    forEachItem(chunks[c], [&](int e, size_t i, const char *&s) {
+      if (e == vertexElem) {
+        float values[kNumRoles + 1] = {};
+        for (size_t k = 0; k < vertices.props.size(); ++k) {
+          const PlyProperty &prop = vertices.props[k];
+          if (binary) {
+            values[propRoles[k]] = readBinary(s, prop.type, swap);
+            s += plyTypeSize(prop.type);
+          } else {
+            values[propRoles[k]] = parseFloat(s);
+          }
+        }
+        mesh->p[i] = vec3(values[kX], values[kY], values[kZ]);
+        if (hasNormals) mesh->n[i] = vec3(values[kNX], values[kNY], values[kNZ]);
+        if (hasUVs) mesh->uv[i] = Point2f(values[kU], values[kV]);
+      } else if (e == faceElem) {
+        for (int k = 0; k <= faceList; ++k) {
+          const PlyProperty &prop = faces.props[k];
+          size_t count = 1;
+          if (prop.isList) {
+            if (binary) {
+              count = readBinary(s, prop.countType, swap);
+              s += plyTypeSize(prop.countType);
+            } else {
+              count = parseInt(s);
+            }
+          }
+          if (k < faceList) {
+            if (binary) {
+              s += count * plyTypeSize(prop.type);
+            } else {
+              for (size_t j = 0; j < count; ++j) parseFloat(s);
+            }
+            continue;
+          }
+          uint32_t first = 0, prev = 0;
+          for (size_t j = 0; j < count; ++j) {
+            int64_t idx;
+            if (binary) {
+              idx = static_cast<int64_t>(readBinary(s, prop.type, swap));
+              s += plyTypeSize(prop.type);
+            } else {
+              idx = parseInt(s);
+            }
+            if (idx < 0 || idx >= static_cast<int64_t>(vertices.count)) {
+              valid = false;
+              idx = 0;
+            }
+            uint32_t cur = static_cast<uint32_t>(idx);
+            if (j == 0) {
+              first = cur;
+            } else if (j >= 2) {
+              // Fan triangulation around the first corner
+              mesh->indices[corner++] = first;
+              mesh->indices[corner++] = prev;
+              mesh->indices[corner++] = cur;
+            }
+            prev = cur;
+          }
+        }
+      }
+      return true;
+    });
+  });
+  if (!valid) {
+    std::cerr << "Invalid face index in " << path << std::endl;
+    return nullptr;
+  }
+  return mesh;
+}
+
+sPtr<TriangleMesh> loadMesh(const std::string &path, material *mat) {
+  std::string ext = path.substr(path.find_last_of('.') + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  if (ext == "obj") {
+    return loadOBJ(path, mat);
+  } else if (ext == "ply") {
+    return loadPLY(path, mat);
+  }
+  std::cerr << "Unsupported mesh format: " << path << std::endl;
+  return nullptr;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+#include "smartpointerhelp.h"
+#include "triangle.h"
+
+// Load a Wavefront OBJ or a PLY (ascii or binary) triangle mesh, the format is
+// picked from the file extension. Polygons are triangulated as fans.
+// The file is split into chunks that are parsed on the thread pool straight
+// into the flat buffers of the mesh, so parallelInit() should be called first
+// to get any speed up. Returns nullptr and prints the reason on failure.
+sPtr<TriangleMesh> loadMesh(const std::string &path, material *mat);
+sPtr<TriangleMesh> loadOBJ(const std::string &path, material *mat);
+sPtr<TriangleMesh> loadPLY(const std::string &path, material *mat);
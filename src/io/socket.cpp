@@ -0,0 +1,196 @@
+#include "io/socket.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+bool isUnixPath(const std::string &address) { return address.find('/') != std::string::npos; }
+
+bool unixAddress(const std::string &path, sockaddr_un &addr) {
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path too long: " << path << std::endl;
+    return false;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+// Resolves HOST:PORT, an empty host means every interface when listening
+addrinfo *tcpAddress(const std::string &address, bool passive) {
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    std::cerr << "Expected HOST:PORT or a socket path: " << address << std::endl;
+    return nullptr;
+  }
+  std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  addrinfo *result = nullptr;
+  int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+  if (error != 0) {
+    std::cerr << "Cannot resolve " << address << ": " << gai_strerror(error) << std::endl;
+    return nullptr;
+  }
+  return result;
+}
+
+}  // namespace
+
+Socket &Socket::operator=(Socket &&s) {
+  if (this != &s) {
+    close();
+    fd = s.fd;
+    buffered = std::move(s.buffered);
+    s.fd = -1;
+  }
+  return *this;
+}
+
+void Socket::close() {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+Socket Socket::listen(const std::string &address) {
+  Socket s;
+  if (isUnixPath(address)) {
+    sockaddr_un addr;
+    if (!unixAddress(address, addr)) {
+      return s;
+    }
+    // A socket file left behind by an earlier run would make bind fail
+    unlink(address.c_str());
+    s.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s.valid() && (bind(s.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+                      ::listen(s.fd, SOMAXCONN) != 0)) {
+      s.close();
+    }
+  } else {
+    addrinfo *info = tcpAddress(address, true);
+    for (addrinfo *p = info; p && !s.valid(); p = p->ai_next) {
+      s.fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+      int on = 1;
+      if (s.valid() && (setsockopt(s.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+                        bind(s.fd, p->ai_addr, p->ai_addrlen) != 0 ||
+                        ::listen(s.fd, SOMAXCONN) != 0)) {
+        s.close();
+      }
+    }
+    if (info) {
+      freeaddrinfo(info);
+    }
+  }
+  if (!s.valid()) {
+    std::cerr << "Cannot listen on " << address << ": " << std::strerror(errno) << std::endl;
+  }
+  return s;
+}
+
+Socket Socket::connect(const std::string &address) {
+  Socket s;
+  if (isUnixPath(address)) {
+    sockaddr_un addr;
+    if (!unixAddress(address, addr)) {
+      return s;
+    }
+    s.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s.valid() && ::connect(s.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      s.close();
+    }
+  } else {
+    addrinfo *info = tcpAddress(address, false);
+    for (addrinfo *p = info; p && !s.valid(); p = p->ai_next) {
+      s.fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+      if (s.valid() && ::connect(s.fd, p->ai_addr, p->ai_addrlen) != 0) {
+        s.close();
+      }
+    }
+    if (info) {
+      freeaddrinfo(info);
+    }
+    // Messages are written whole, don't hold small ones back
+    int on = 1;
+    if (s.valid()) {
+      setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+  }
+  return s;
+}
+
+Socket Socket::accept() const {
+  Socket s(::accept(fd, nullptr, nullptr));
+  if (!s.valid()) {
+    std::cerr << "Accepting a connection failed: " << std::strerror(errno) << std::endl;
+    return s;
+  }
+  int on = 1;
+  // Fails harmlessly on Unix sockets
+  setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return s;
+}
+
+bool Socket::sendAll(const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool Socket::receiveAll(void *data, size_t size) {
+  char *p = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool Socket::receiveLine(std::string &line) {
+  size_t end;
+  while ((end = buffered.find('\n')) == std::string::npos) {
+    char chunk[4096];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffered.append(chunk, n);
+  }
+  line = buffered.substr(0, end);
+  buffered.erase(0, end + 1);
+  return true;
+}
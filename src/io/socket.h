@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Blocking stream socket. Addresses containing a '/' are Unix domain socket
+// paths, e.g. ./render.sock, anything else is HOST:PORT over TCP. Failures are
+// reported on stderr and leave the socket invalid.
+class Socket {
+public:
+  Socket() {}
+  explicit Socket(int fd) : fd(fd) {}
+  ~Socket() { close(); }
+  Socket(Socket &&s) : fd(s.fd), buffered(std::move(s.buffered)) { s.fd = -1; }
+  Socket &operator=(Socket &&s);
+  Socket(const Socket &) = delete;
+  Socket &operator=(const Socket &) = delete;
+
+  static Socket listen(const std::string &address);
+  static Socket connect(const std::string &address);
+  Socket accept() const;
+
+  bool valid() const { return fd >= 0; }
+  int getFd() const { return fd; }
+  // Transfer exactly size bytes, false on error or when the peer has closed
+  // the connection. A closed peer never raises SIGPIPE.
+  bool sendAll(const void *data, size_t size);
+  bool receiveAll(void *data, size_t size);
+  // Reads up to the next newline, which is dropped. Bytes after it are kept
+  // for the next call, so lines and whole messages must not be mixed.
+  bool receiveLine(std::string &line);
+  void close();
+
+private:
+  int fd = -1;
+  std::string buffered;
+};
@@ -0,0 +1,312 @@
+#include "io/texture_cache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace {
+
+const char kMagic[8] = {'R', 'T', 'T', 'E', 'X', '\0', '\0', '\0'};
+// Bump whenever the layout of the header or of the tiles changes
+const uint32_t kVersion = 1;
+const uint32_t kEndianMarker = 0x01020304;
+// Tiles start at a page boundary and are whole pages, 64 x 64 x 3 bytes
+const uint64_t kAlignment = 4096;
+const uint64_t kTileBytes = uint64_t(kTextureTileSize) * kTextureTileSize * 3;
+const int kMaxLevels = 32;
+
+struct TiledImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endianMarker;
+  uint32_t tileSize;
+  uint32_t levels;
+  uint64_t sourceSize;
+  int64_t sourceMtime;
+  uint64_t dataOffset;
+  // Size of every level, the full image first
+  int32_t widths[kMaxLevels];
+  int32_t heights[kMaxLevels];
+};
+
+bool getSourceStamp(const std::string &sourcePath, uint64_t &size, int64_t &mtime) {
+  size = 0;
+  mtime = 0;
+  if (sourcePath.empty()) {
+    return true;
+  }
+  struct stat st;
+  if (stat(sourcePath.c_str(), &st) != 0) {
+    return false;
+  }
+  size = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
+
+int tileCount(int texels) { return (texels + kTextureTileSize - 1) / kTextureTileSize; }
+
+}  // namespace
+
+bool writeTiledImage(const std::string &path, const uint8_t *pixels, int width, int height,
+                     int channels, const std::string &sourcePath) {
+  if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+    std::cerr << "Cannot tile an image of " << width << "x" << height << "x" << channels
+              << std::endl;
+    return false;
+  }
+  std::vector<uint8_t> texels;
+  texels.reserve(size_t(width) * height * 4);
+  for (size_t i = 0; i < size_t(width) * height; ++i) {
+    const uint8_t *p = pixels + i * channels;
+    // Grey, with or without alpha
+    texels.insert(texels.end(), {p[0], p[channels < 3 ? 0 : 1], p[channels < 3 ? 0 : 2]});
+  }
+  std::vector<raytracer::MipLevel> levels = raytracer::buildMipmap(texels, width, height);
+
+  TiledImageHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.endianMarker = kEndianMarker;
+  header.tileSize = kTextureTileSize;
+  header.levels = levels.size();
+  header.dataOffset = (sizeof(header) + kAlignment - 1) / kAlignment * kAlignment;
+  for (size_t l = 0; l < levels.size(); ++l) {
+    header.widths[l] = levels[l].width;
+    header.heights[l] = levels[l].height;
+  }
+  if (!getSourceStamp(sourcePath, header.sourceSize, header.sourceMtime)) {
+    std::cerr << "Cannot stat " << sourcePath << std::endl;
+    return false;
+  }
+
+  // Write to a temporary file and rename it, so that a concurrent or
+  // interrupted run never opens a half written file
+  std::string tmpPath = path + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "wb");
+  if (!file) {
+    std::cerr << "Open file failed: " << tmpPath << std::endl;
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  static const char zeros[kAlignment] = {};
+  ok = ok && fwrite(zeros, 1, header.dataOffset - sizeof(header), file) ==
+                 header.dataOffset - sizeof(header);
+  // Texels past the edge of a level repeat the last row and column
+  std::vector<uint8_t> tile(kTileBytes);
+  for (const raytracer::MipLevel &level : levels) {
+    for (int ty = 0; ty < tileCount(level.height) && ok; ++ty) {
+      for (int tx = 0; tx < tileCount(level.width) && ok; ++tx) {
+        for (int y = 0; y < kTextureTileSize; ++y) {
+          int sy = std::min(ty * kTextureTileSize + y, level.height - 1);
+          for (int x = 0; x < kTextureTileSize; ++x) {
+            int sx = std::min(tx * kTextureTileSize + x, level.width - 1);
+            const uint8_t *src = &texels[level.offset + (size_t(sy) * level.width + sx) * 3];
+            std::copy(src, src + 3, &tile[(y * kTextureTileSize + x) * 3]);
+          }
+        }
+        ok = fwrite(tile.data(), 1, kTileBytes, file) == kTileBytes;
+      }
+    }
+  }
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::cerr << "Writing tiled image " << path << " failed" << std::endl;
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+TiledImage::~TiledImage() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+sPtr<TiledImage> TiledImage::open(const std::string &path, const std::string &sourcePath) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  sPtr<TiledImage> image(new TiledImage());
+  image->fd = fd;
+  image->path = path;
+  TiledImageHeader header;
+  struct stat st;
+  uint64_t sourceSize;
+  int64_t sourceMtime;
+  if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+      header.endianMarker != kEndianMarker || header.tileSize != uint32_t(kTextureTileSize) ||
+      header.levels == 0 || header.levels > uint32_t(kMaxLevels) ||
+      !getSourceStamp(sourcePath, sourceSize, sourceMtime) || sourceSize != header.sourceSize ||
+      sourceMtime != header.sourceMtime) {
+    return nullptr;
+  }
+  uint64_t tiles = 0;
+  for (uint32_t l = 0; l < header.levels; ++l) {
+    image->levels.push_back({header.widths[l], header.heights[l], 0});
+    image->firstTile.push_back(tiles);
+    image->tilesX.push_back(tileCount(header.widths[l]));
+    tiles += uint64_t(tileCount(header.widths[l])) * tileCount(header.heights[l]);
+  }
+  image->dataOffset = header.dataOffset;
+  if (header.dataOffset + tiles * kTileBytes > uint64_t(st.st_size)) {
+    std::cerr << "Tiled image " << path << " is truncated" << std::endl;
+    return nullptr;
+  }
+  static std::atomic<uint32_t> nextId(0);
+  image->id = nextId++;
+  return image;
+}
+
+bool TiledImage::readTile(int level, int tx, int ty, std::vector<uint8_t> &tile) const {
+  tile.resize(kTileBytes);
+  uint64_t offset =
+      dataOffset + (firstTile[level] + uint64_t(ty) * tilesX[level] + tx) * kTileBytes;
+  size_t done = 0;
+  while (done < kTileBytes) {
+    ssize_t n = pread(fd, tile.data() + done, kTileBytes - done, offset + done);
+    if (n <= 0) {
+      std::cerr << "Reading a tile of " << path << " failed" << std::endl;
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+void TiledImage::texel(int level, int x, int y, uint8_t rgb[3]) const {
+  // Nearby lookups mostly hit the same few tiles, on one or two levels. Every
+  // thread keeps the last tiles it used in a small direct mapped table and
+  // only goes to the shared cache, and its locks, for others.
+  struct RecentTile {
+    uint64_t key = ~uint64_t(0);
+    sPtr<const std::vector<uint8_t>> texels;
+  };
+  static thread_local RecentTile recent[16];
+  int tx = x / kTextureTileSize, ty = y / kTextureTileSize;
+  uint64_t key = TextureCache::tileKey(*this, level, tx, ty);
+  RecentTile &r = recent[(tx + 3 * ty + 5 * level) & 15];
+  if (r.key != key) {
+    r.texels = TextureCache::instance().tile(*this, level, tx, ty);
+    // A tile that failed to load is not remembered, the next lookup retries
+    r.key = r.texels ? key : ~uint64_t(0);
+  }
+  if (!r.texels) {
+    rgb[0] = rgb[1] = rgb[2] = 0;
+    return;
+  }
+  const uint8_t *t =
+      &(*r.texels)[((y % kTextureTileSize) * kTextureTileSize + x % kTextureTileSize) * 3];
+  std::copy(t, t + 3, rgb);
+}
+
+sPtr<TiledImage> loadTiledImage(const std::string &imagePath, const std::string &cachePath) {
+  sPtr<TiledImage> image = TiledImage::open(cachePath, imagePath);
+  if (image) {
+    return image;
+  }
+  int width, height, channels;
+  unsigned char *pixels = stbi_load(imagePath.c_str(), &width, &height, &channels, 0);
+  if (!pixels) {
+    std::cerr << "Cannot read image " << imagePath << std::endl;
+    return nullptr;
+  }
+  bool ok = writeTiledImage(cachePath, pixels, width, height, channels, imagePath);
+  stbi_image_free(pixels);
+  return ok ? TiledImage::open(cachePath, imagePath) : nullptr;
+}
+
+TextureCache &TextureCache::instance() {
+  static TextureCache cache;
+  return cache;
+}
+
+void TextureCache::setBudget(uint64_t bytes) {
+  budget = bytes;
+  for (Shard &shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    evict(shard, budget / kShards);
+  }
+}
+
+TextureCache::Stats TextureCache::getStats() const {
+  Stats stats;
+  for (const Shard &shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    stats.hits += shard.hits;
+    stats.misses += shard.misses;
+    stats.evictions += shard.evictions;
+  }
+  std::lock_guard<std::mutex> lock(totalMutex);
+  stats.bytes = totalBytes;
+  stats.peakBytes = peakBytes;
+  return stats;
+}
+
+void TextureCache::evict(Shard &shard, uint64_t limit) {
+  int64_t freed = 0;
+  while (shard.bytes > limit && !shard.lru.empty()) {
+    auto it = shard.tiles.find(shard.lru.back());
+    shard.bytes -= it->second.texels->size();
+    freed += it->second.texels->size();
+    shard.tiles.erase(it);
+    shard.lru.pop_back();
+    ++shard.evictions;
+  }
+  if (freed > 0) {
+    addBytes(-freed);
+  }
+}
+
+void TextureCache::addBytes(int64_t bytes) {
+  std::lock_guard<std::mutex> lock(totalMutex);
+  totalBytes += bytes;
+  peakBytes = std::max(peakBytes, totalBytes);
+}
+
+sPtr<const std::vector<uint8_t>> TextureCache::tile(const TiledImage &image, int level, int tx,
+                                                    int ty) {
+  Key key = tileKey(image, level, tx, ty);
+  Shard &shard = shards[(key * 0x9E3779B97F4A7C15ull) >> 60];
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.tiles.find(key);
+    if (it != shard.tiles.end()) {
+      ++shard.hits;
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+      return it->second.texels;
+    }
+    ++shard.misses;
+  }
+
+  // Read without the lock. Two threads missing the same tile both read it,
+  // the second keeps the copy of the first.
+  auto texels = mkS<std::vector<uint8_t>>();
+  if (!image.readTile(level, tx, ty, *texels)) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.tiles.find(key);
+  if (it != shard.tiles.end()) {
+    return it->second.texels;
+  }
+  shard.lru.push_front(key);
+  shard.tiles[key] = {texels, shard.lru.begin()};
+  shard.bytes += texels->size();
+  addBytes(texels->size());
+  evict(shard, budget / kShards);
+  return texels;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "core/mipmap.h"
+#include "smartpointerhelp.h"
+
+// Out of core image textures. An image is converted once into a tiled file
+// holding its whole mip pyramid cut into square tiles of packed 8 bit RGB,
+// every tile the same size and page aligned. Opening the file only reads the
+// level table; tiles are read on first touch into a cache shared by all
+// images and threads, which evicts the least recently used tiles to stay
+// within its memory budget. The image itself is only decoded during the
+// conversion, so rendering needs no more texture memory than the budget.
+
+// Tiles are kTextureTileSize texels square, smaller at the right and bottom
+// edges of a level only in the texels that are used
+const int kTextureTileSize = 64;
+
+// Converts an image of width x height pixels with 1 to 4 channels, rows from
+// the top, into a tiled file at path. When sourcePath is given, its size and
+// modification time are recorded and a file whose source has changed since
+// is rejected when opening.
+bool writeTiledImage(const std::string &path, const uint8_t *pixels, int width, int height,
+                     int channels, const std::string &sourcePath = "");
+
+// An open tiled file. Tiles are read through the TextureCache.
+class TiledImage {
+public:
+  ~TiledImage();
+  TiledImage(const TiledImage &) = delete;
+  TiledImage &operator=(const TiledImage &) = delete;
+
+  // Returns nullptr when the file is missing, stale or written by another
+  // version
+  static sPtr<TiledImage> open(const std::string &path, const std::string &sourcePath = "");
+
+  const std::vector<raytracer::MipLevel> &getLevels() const { return levels; }
+  // Texel x, y of a level, read through the cache. Black when the tile
+  // cannot be read.
+  void texel(int level, int x, int y, uint8_t rgb[3]) const;
+
+private:
+  friend class TextureCache;
+  TiledImage() = default;
+  // Reads one tile from the file into tile, false on errors
+  bool readTile(int level, int tx, int ty, std::vector<uint8_t> &tile) const;
+
+  int fd = -1;
+  // Unique among all images ever opened, so keys of closed images never match
+  uint32_t id = 0;
+  std::string path;
+  std::vector<raytracer::MipLevel> levels;
+  // Index of the first tile of every level, and tiles per row of it
+  std::vector<uint64_t> firstTile;
+  std::vector<int> tilesX;
+  uint64_t dataOffset = 0;
+};
+
+// Opens the tiled file at cachePath when it is up to date with imagePath,
+// otherwise decodes the image and converts it first. Returns nullptr when
+// the image cannot be read.
+sPtr<TiledImage> loadTiledImage(const std::string &imagePath, const std::string &cachePath);
+
+// Tiles of all tiled images, shared by the render threads. The tiles are
+// split over shards by their key, each with its own lock, least recently
+// used list and a share of the budget, so threads touching different tiles
+// rarely wait for each other. Tiles are read without holding the lock.
+class TextureCache {
+public:
+  struct Stats {
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    // Bytes of the tiles held now, and the most held at once
+    uint64_t bytes = 0, peakBytes = 0;
+  };
+
+  static TextureCache &instance();
+
+  // Evicts tiles down to the new budget right away
+  void setBudget(uint64_t bytes);
+  uint64_t getBudget() const { return budget; }
+  Stats getStats() const;
+
+  // The texels of a tile, read from the file on a miss. Stays valid while
+  // the caller holds it, even when evicted. nullptr when reading fails.
+  sPtr<const std::vector<uint8_t>> tile(const TiledImage &image, int level, int tx, int ty);
+
+  // 20 bits of image, 5 of level and 19 and 20 of tile row and column
+  static uint64_t tileKey(const TiledImage &image, int level, int tx, int ty) {
+    return (uint64_t(image.id) << 44) | (uint64_t(level) << 39) | (uint64_t(ty) << 20) |
+           uint64_t(tx);
+  }
+
+private:
+  static const int kShards = 16;
+  using Key = uint64_t;
+  struct Entry {
+    sPtr<const std::vector<uint8_t>> texels;
+    std::list<Key>::iterator lru;
+  };
+  struct Shard {
+    mutable std::mutex mutex;
+    // Most recently used first
+    std::list<Key> lru;
+    std::unordered_map<Key, Entry> tiles;
+    uint64_t bytes = 0;
+    uint64_t hits = 0, misses = 0, evictions = 0;
+  };
+
+  TextureCache() = default;
+  // Drops the least recently used tiles of a locked shard until it fits
+  void evict(Shard &shard, uint64_t limit);
+  void addBytes(int64_t bytes);
+
+  Shard shards[kShards];
+  std::atomic<uint64_t> budget{uint64_t(1024) << 20};
+  mutable std::mutex totalMutex;
+  uint64_t totalBytes = 0, peakBytes = 0;
+};
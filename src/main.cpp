@@ -1,116 +1,101 @@
 #include <chrono>
-#include <fstream>
+#include <csignal>
+#include <iomanip>
 #include <iostream>
-#include <limits>
-#include <thread>
-#include <vector>
+#include <memory>
 
+#include "benchmark.h"
 #include "camera.h"
 #include "core/parallel.h"
-#include "float.h"
-#include "pdf.h"
-#include "rect.h"
+#include "distributed.h"
+#include "io/image_io.h"
+#include "io/texture_cache.h"
+#include "options.h"
+#include "renderer.h"
 #include "scene.h"
-#include "smartpointerhelp.h"
+#include "server.h"
 
-vec3 color(const Ray &r, Hitable *world, Hitable *light, int depth) {
-  HitRecord hrec;
-  // 0.001 for avoiding t close to 0
-  if (world->hit(r, 0.001, FLT_MAX, hrec)) {
-    scatter_record srec;
-    vec3 emitted = hrec.mat_ptr->emitted(r, hrec, hrec.u, hrec.v, hrec.p);
-    if (depth < 5 && hrec.mat_ptr->scatter(r, hrec, &srec)) {
-      // For specular, we don't care about the pdf distribution
-      if (srec.is_specular) {
-        return srec.attenuation * color(srec.specular_ray, world, light, depth + 1);
-      }
-      // Calculate scatter ray
-      vec3 v = light->random(hrec.p);
-      Ray scattered = Ray(hrec.p, v, r.time());
-      float incidentPdf = light->pdf_value(hrec.p, scattered.direction());
-      float scatterPdf = hrec.mat_ptr->scattering_pdf(r, hrec, scattered);
-      emitted += srec.attenuation * color(scattered, world, light, depth + 1) *
-                 scatterPdf / incidentPdf;
-    }
-    return emitted;
+// Loads the scene once and renders tiles for a coordinator until it is done
+static int runWorker(Options options) {
+  raytracer::parallelInit();
+  RenderWorker worker;
+  bool ok = worker.connect(options.worker, options);
+  if (ok) {
+    Scene scene(options.scene, 0, options.mesh);
+    Renderer renderer(&scene, makeCamera(options), options);
+    ok = worker.serve(renderer);
   }
-  return vec3(0.f);
+  raytracer::parallelClean();
+  return ok ? 0 : 1;
+}
+
+// Loads the scene once and renders jobs until told to quit. Signals are left
+// at their default, they end the server rather than the current job.
+static int runServer(const Options &options) {
+  raytracer::parallelInit();
+  Scene scene(options.scene, 0, options.mesh);
+  RenderServer server(scene, options);
+  bool ok = server.serve(options.serve);
+  raytracer::parallelClean();
+  return ok ? 0 : 1;
 }
 
-int main() {
-  int nx = 800,  // width
-      ny = 800,  // height
-      ns = 100,  // number of samples
-      tileSize = 16;
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    return 1;
+  }
+  TextureCache::instance().setBudget(uint64_t(options.textureCacheMB) << 20);
+  if (!options.worker.empty()) {
+    return runWorker(options);
+  }
+  if (!options.serve.empty()) {
+    return runServer(options);
+  }
+  if (!options.benchmark.empty()) {
+    return runBenchmark(options);
+  }
+  int nx = options.width, ny = options.height;
   std::cout << "Image size: " << nx << "x" << ny << std::endl;
-  std::cout << "Samples per pixel: " << ns << std::endl;
-  std::cout << "Tile size: " << tileSize << std::endl;
+  std::cout << "Samples per pixel: " << options.spp << std::endl;
+  std::cout << "Tile size: " << options.tileSize << std::endl;
   raytracer::parallelInit();
-  Scene scene = Scene();
-  // vec3 lookfrom(0, 0, 10);
-  // vec3 lookat(0, 0, -1);
-  vec3 lookfrom(278, 278, -600), lookat(278, 278, 0);
-  float dist_to_focus = (lookat - lookfrom).length();
-  float aperture = 0.0;
-  float vfov = 50.0;
-  vec3 vup(0, 1, 0);
-  camera cam(lookfrom, lookat, vup, vfov, float(nx) / float(ny), aperture,
-             dist_to_focus, 0.0, 0.0);
-  int res[nx * ny * 3];
-  auto start = std::chrono::steady_clock::now();
-  int yNumTiles = (ny + tileSize - 1) / tileSize;
-  int xNumTiles = (nx + tileSize - 1) / tileSize;
-  
-  auto renderTile = [&](const Point2i &count) {
-    int tileX = count.x, tileY = count.y;
-    for (int x = tileX * tileSize; x < std::min((tileX + 1) * tileSize, nx);
-         x++) {
-      for (int y = tileY * tileSize; y < std::min((tileY + 1) * tileSize, ny);
-           y++) {
-        vec3 col(0.f);
-        for (int s = 0; s < ns; s++) {
-          float u = float(x + (float)rand() / RAND_MAX) / nx;
-          float v = float(y + (float)rand() / RAND_MAX) / ny;
-          Ray r = cam.get_ray(u, v);
-          vec3 c = color(r, scene.world, scene.light, 0); 
-          de_nan(c);
-          col += c;
-        }
-        col /= float(ns);
-        // gamma 2
-        col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
-        col = clamp(col, 0.f, 1.f);
-        int key = 3 * ((ny - 1 - y) * nx + x);
-        res[key] = round(255.f * col[0]);
-        res[key + 1] = round(255.f * col[1]);
-        res[key + 2] = round(255.f * col[2]);
-      }
+  // A coordinator only merges tiles, the workers have the scene
+  std::unique_ptr<Scene> scene;
+  RenderCoordinator coordinator(options);
+  if (options.coordinator.empty()) {
+    scene.reset(new Scene(options.scene, 0, options.mesh));
+    if (options.bvhReport) {
+      scene->reportBVHs(std::cout);
     }
-  };
+  } else if (!coordinator.listen(options.coordinator)) {
+    raytracer::parallelClean();
+    return 1;
+  }
 
-  raytracer::ParallelFor2d(renderTile, Point2i(xNumTiles, yNumTiles));
-  // for (int i = 0; i < xNumTiles; ++i) {
-  //   for (int j = 0; j < yNumTiles; ++j) {
-  //     renderTile(Point2i(i, j));
-  //   }
-  // }
+  AsyncImageWriter writer;
+  Renderer renderer(scene.get(), makeCamera(options), options);
+  if (!options.coordinator.empty()) {
+    renderer.setCoordinator(&coordinator);
+  }
+  if (options.resume && !renderer.loadCheckpoint(options.checkpoint)) {
+    raytracer::parallelClean();
+    return 1;
+  }
+  // Preemption sends SIGTERM, finish the running tiles and save instead of
+  // losing everything
+  signal(SIGINT, [](int) { Renderer::requestStop(); });
+  signal(SIGTERM, [](int) { Renderer::requestStop(); });
+  auto start = std::chrono::steady_clock::now();
+  renderer.render(writer);
+  coordinator.finish();
   raytracer::parallelClean();
 
   auto end = std::chrono::steady_clock::now();
   std::chrono::duration<double> diff = end - start;
   std::cout << "Render time: " << diff.count() << "s\n";
-  std::cout << "Speed: " << std::setprecision(3) << nx * ny * ns / diff.count()
+  std::cout << "Speed: " << std::setprecision(3)
+            << renderer.getStats().rays() / diff.count()
             << " rays per second" << std::endl;
-  std::ofstream outFile;
-  outFile.open("img.ppm");
-  if (outFile.is_open()) {
-    outFile << "P3\n" << nx << " " << ny << "\n255\n";
-    for (int i = 0; i < nx * ny * 3; i += 3) {
-      outFile << res[i] << " " << res[i + 1] << " " << res[i + 2] << std::endl;
-    }
-    outFile.close();
-  } else {
-    std::cout << "Open file failed" << std::endl;
-  }
-  return 0;
-}
\ No newline at end of file
+  return writer.wait() ? 0 : 1;
+}
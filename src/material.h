@@ -10,7 +10,7 @@
 inline vec3 random_in_unit_sphere() {
   vec3 p;
   do {
-    p = 2.0 * vec3(drand48(), drand48(), drand48()) - vec3(1, 1, 1);
+    p = 2.0 * vec3(random_float(), random_float(), random_float()) - vec3(1, 1, 1);
   } while (p.squared_length() >= 1.0);
   return p;
 }
@@ -72,7 +72,7 @@ class lambertian : public material {
   virtual bool scatter(const Ray &r_in, const HitRecord &hrec,
                        scatter_record *srec) const {
     srec->is_specular = false;
-    srec->attenuation = albedo->value(hrec.u, hrec.v, hrec.p);
+    srec->attenuation = albedo->value(hrec.u, hrec.v, hrec.p, hrec.du, hrec.dv);
     srec->pdf_ptr = mkU<cosine_pdf>(hrec.normal);
     return true;
   }
@@ -124,7 +124,7 @@ class dielectric : public material {
     if (refract(r_in.direction(), outward_normal, ni_over_nt, refracted)) {
       reflect_prob = schlick(cosine, ref_idx);
     }
-    srec->specular_ray = drand48() < reflect_prob ? Ray(rec.p, reflected)
+    srec->specular_ray = random_float() < reflect_prob ? Ray(rec.p, reflected)
                                                   : Ray(rec.p, refracted);
     return true;
   }
@@ -141,7 +141,7 @@ class diffuse_light : public material {
   virtual vec3 emitted(const Ray &r_in, const HitRecord &hrec, float u,
                        float v, const vec3 &p) const {
     if (dot(r_in.direction(), hrec.normal) < 0.f) {
-      return emit->value(u, v, p);
+      return emit->value(u, v, p, hrec.du, hrec.dv);
     }
     return vec3(0.f);
   }
@@ -153,8 +153,12 @@ class isotropic : public material {
   isotropic(texture *a) : albedo(a) {}
   virtual bool scatter(const Ray &, const HitRecord &rec,
                        scatter_record *srec) const {
+    // The phase function is sampled exactly, so it is handled like a specular
+    // bounce without light sampling
     srec->specular_ray = Ray(rec.p, random_in_unit_sphere());
     srec->attenuation = albedo->value(rec.u, rec.v, rec.p);
+    srec->is_specular = true;
+    srec->pdf_ptr = nullptr;
     return true;
   }
   texture *albedo;
@@ -1,8 +1,12 @@
 #include "medium.h"
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
 bool constant_medium::hit(const Ray& r, float t_min, float t_max,
                           HitRecord& rec) const {
-  bool db = (drand48() < 0.00001);
+  bool db = (random_float() < 0.00001);
   db = false;
   HitRecord rec1, rec2;
   if (boundary->hit(r, -FLT_MAX, FLT_MAX, rec1)) {
@@ -14,7 +18,7 @@ bool constant_medium::hit(const Ray& r, float t_min, float t_max,
       if (rec1.t < 0) rec1.t = 0;
       float distance_inside_boundary =
           (rec2.t - rec1.t) * r.direction().length();
-      float hit_distance = -(1 / density) * log(drand48());
+      float hit_distance = -(1 / density) * log(random_float());
       if (hit_distance < distance_inside_boundary) {
         if (db) std::cerr << "hit_distance = " << hit_distance << "\n";
         rec.t = rec1.t + hit_distance / r.direction().length();
@@ -22,6 +26,7 @@ bool constant_medium::hit(const Ray& r, float t_min, float t_max,
         rec.p = r.point_at_parameter(rec.t);
         if (db) std::cerr << "rec.p = " << rec.p << "\n";
         rec.normal = vec3(1, 0, 0);  // arbitrary
+        rec.dpdu = rec.dpdv = 0.f;
         rec.mat_ptr = phase_function;
         return true;
       }
@@ -29,3 +34,223 @@ bool constant_medium::hit(const Ray& r, float t_min, float t_max,
   }
   return false;
 }
+
+grid_medium::grid_medium(const aabb &bounds, int nx, int ny, int nz,
+                         const std::vector<float> &densities, float scale, texture *a,
+                         int brick)
+    : phase_function(new isotropic(a)), bounds(bounds), n{nx, ny, nz}, brickShift(0) {
+  if (nx < 2 || ny < 2 || nz < 2 || densities.size() != size_t(nx) * ny * nz) {
+    std::cerr << "Cannot build a medium of " << densities.size() << " densities on a " << nx
+              << "x" << ny << "x" << nz << " grid" << std::endl;
+    n[0] = n[1] = n[2] = 0;
+    bricksPerAxis[0] = bricksPerAxis[1] = bricksPerAxis[2] = 0;
+    return;
+  }
+  while ((1 << brickShift) < brick) {
+    ++brickShift;
+  }
+  const int size = 1 << brickShift;
+  vec3 extent = bounds.max() - bounds.min();
+  toGrid = vec3(nx / extent.x(), ny / extent.y(), nz / extent.z());
+  for (int a = 0; a < 3; ++a) {
+    bricksPerAxis[a] = (n[a] + size - 1) >> brickShift;
+  }
+  brickOffset.assign(size_t(bricksPerAxis[0]) * bricksPerAxis[1] * bricksPerAxis[2], -1);
+  majorants.assign(brickOffset.size(), 0.f);
+
+  auto at = [&](int x, int y, int z) { return densities[(size_t(z) * ny + y) * nx + x] * scale; };
+  size_t b = 0;
+  for (int bz = 0; bz < bricksPerAxis[2]; ++bz) {
+    for (int by = 0; by < bricksPerAxis[1]; ++by) {
+      for (int bx = 0; bx < bricksPerAxis[0]; ++bx, ++b) {
+        const int lo[3] = {bx * size, by * size, bz * size};
+        const int hi[3] = {std::min(lo[0] + size, nx), std::min(lo[1] + size, ny),
+                           std::min(lo[2] + size, nz)};
+        bool empty = true;
+        for (int z = lo[2]; z < hi[2] && empty; ++z) {
+          for (int y = lo[1]; y < hi[1] && empty; ++y) {
+            for (int x = lo[0]; x < hi[0] && empty; ++x) {
+              empty = at(x, y, z) <= 0.f;
+            }
+          }
+        }
+        if (!empty) {
+          brickOffset[b] = bricks.size();
+          bricks.resize(bricks.size() + size * size * size, 0.f);
+          float *voxels = &bricks[brickOffset[b]];
+          for (int z = lo[2]; z < hi[2]; ++z) {
+            for (int y = lo[1]; y < hi[1]; ++y) {
+              for (int x = lo[0]; x < hi[0]; ++x) {
+                voxels[(((z - lo[2]) * size) + y - lo[1]) * size + x - lo[0]] = at(x, y, z);
+              }
+            }
+          }
+        }
+        // Points in the brick interpolate the voxels around them, up to one
+        // voxel into the next bricks
+        float majorant = 0.f;
+        for (int z = std::max(lo[2] - 1, 0); z < std::min(hi[2] + 1, nz); ++z) {
+          for (int y = std::max(lo[1] - 1, 0); y < std::min(hi[1] + 1, ny); ++y) {
+            for (int x = std::max(lo[0] - 1, 0); x < std::min(hi[0] + 1, nx); ++x) {
+              majorant = std::max(majorant, at(x, y, z));
+            }
+          }
+        }
+        majorants[b] = majorant;
+      }
+    }
+  }
+}
+
+float grid_medium::voxel(int x, int y, int z) const {
+  const int s = brickShift, m = (1 << s) - 1;
+  int64_t offset =
+      brickOffset[(size_t(z >> s) * bricksPerAxis[1] + (y >> s)) * bricksPerAxis[0] + (x >> s)];
+  if (offset < 0) {
+    return 0.f;
+  }
+  return bricks[offset + ((((z & m) << s) + (y & m)) << s) + (x & m)];
+}
+
+float grid_medium::density(const vec3 &p) const {
+  if (majorants.empty()) {
+    return 0.f;
+  }
+  // Voxel centers are at half integers
+  vec3 g = (p - bounds.min()) * toGrid - vec3(0.5f);
+  float c[3];
+  int i[3];
+  for (int a = 0; a < 3; ++a) {
+    float t = std::min(std::max(g[a], 0.f), float(n[a] - 1));
+    i[a] = std::min(int(t), n[a] - 2);
+    c[a] = t - i[a];
+  }
+  float v[2][2][2];
+  for (int z = 0; z < 2; ++z) {
+    for (int y = 0; y < 2; ++y) {
+      for (int x = 0; x < 2; ++x) {
+        v[z][y][x] = voxel(i[0] + x, i[1] + y, i[2] + z);
+      }
+    }
+  }
+  float x00 = v[0][0][0] + c[0] * (v[0][0][1] - v[0][0][0]);
+  float x10 = v[0][1][0] + c[0] * (v[0][1][1] - v[0][1][0]);
+  float x01 = v[1][0][0] + c[0] * (v[1][0][1] - v[1][0][0]);
+  float x11 = v[1][1][0] + c[0] * (v[1][1][1] - v[1][1][0]);
+  float y0 = x00 + c[1] * (x10 - x00), y1 = x01 + c[1] * (x11 - x01);
+  return y0 + c[2] * (y1 - y0);
+}
+
+template <typename Visit>
+void grid_medium::walk(const Ray &r, float t_min, float t_max, Visit &&visit) const {
+  if (majorants.empty()) {
+    return;
+  }
+  // Clip the ray to the box
+  float t0 = t_min, t1 = t_max;
+  for (int a = 0; a < 3; ++a) {
+    float invD = 1.f / r.direction()[a];
+    float near = (bounds.min()[a] - r.origin()[a]) * invD;
+    float far = (bounds.max()[a] - r.origin()[a]) * invD;
+    if (invD < 0.f) {
+      std::swap(near, far);
+    }
+    t0 = ffmax(near, t0);
+    t1 = ffmin(far, t1);
+    if (t1 <= t0) {
+      return;
+    }
+  }
+
+  // 3D DDA over the bricks, in units of bricks
+  const float size = 1 << brickShift;
+  vec3 o = (r.origin() - bounds.min()) * toGrid / size;
+  vec3 d = r.direction() * toGrid / size;
+  int cell[3], step[3];
+  float next[3], delta[3];
+  for (int a = 0; a < 3; ++a) {
+    cell[a] = clamp(int(std::floor(o[a] + t0 * d[a])), 0, bricksPerAxis[a] - 1);
+    if (d[a] > 0.f) {
+      step[a] = 1;
+      next[a] = (cell[a] + 1 - o[a]) / d[a];
+      delta[a] = 1.f / d[a];
+    } else if (d[a] < 0.f) {
+      step[a] = -1;
+      next[a] = (cell[a] - o[a]) / d[a];
+      delta[a] = -1.f / d[a];
+    } else {
+      step[a] = 0;
+      next[a] = delta[a] = FLT_MAX;
+    }
+  }
+  const float length = r.direction().length();
+  float t = t0;
+  while (true) {
+    int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+    float end = ffmin(next[axis], t1);
+    float majorant =
+        majorants[(size_t(cell[2]) * bricksPerAxis[1] + cell[1]) * bricksPerAxis[0] + cell[0]];
+    if (majorant > 0.f && end > t && visit(t, end, majorant * length)) {
+      return;
+    }
+    cell[axis] += step[axis];
+    if (end >= t1 || cell[axis] < 0 || cell[axis] >= bricksPerAxis[axis]) {
+      return;
+    }
+    t = end;
+    next[axis] += delta[axis];
+  }
+}
+
+bool grid_medium::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const {
+  const float length = r.direction().length();
+  bool collided = false;
+  walk(r, t_min, t_max, [&](float t0, float t1, float majorant) {
+    // Free flights at the rate of the majorant. Past the end of the brick the
+    // flight starts over from there with the rate of the next one, which
+    // gives the same distribution as the exponential has no memory.
+    float t = t0;
+    while (true) {
+      t -= std::log(1.f - random_float()) / majorant;
+      if (t >= t1) {
+        return false;
+      }
+      // A real collision with probability density / majorant, otherwise a
+      // null one that goes on in the same direction
+      vec3 p = r.point_at_parameter(t);
+      if (random_float() * majorant < density(p) * length) {
+        rec.t = t;
+        rec.p = p;
+        collided = true;
+        return true;
+      }
+    }
+  });
+  if (collided) {
+    rec.u = rec.v = 0.f;
+    rec.normal = vec3(1, 0, 0);  // arbitrary
+    rec.dpdu = rec.dpdv = 0.f;
+    rec.mat_ptr = phase_function;
+  }
+  return collided;
+}
+
+float grid_medium::transmittance(const Ray &r, float t_min, float t_max) const {
+  const float length = r.direction().length();
+  float result = 1.f;
+  walk(r, t_min, t_max, [&](float t0, float t1, float majorant) {
+    // Every tentative collision keeps the fraction of null collisions
+    float t = t0;
+    while (true) {
+      t -= std::log(1.f - random_float()) / majorant;
+      if (t >= t1) {
+        return false;
+      }
+      result *= 1.f - density(r.point_at_parameter(t)) * length / majorant;
+      if (result <= 0.f) {
+        return true;
+      }
+    }
+  });
+  return std::max(result, 0.f);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "hitable.h"
 #include "material.h"
 
@@ -17,3 +19,54 @@ class constant_medium : public Hitable {
         float density;
         material *phase_function;
 };
+
+// Heterogeneous medium in a box, its density sampled on a grid of
+// nx x ny x nz voxels and interpolated between the voxel centers. The voxels
+// are stored in bricks of brick^3 and bricks without any density are not
+// stored at all, so a sparse cloud costs little more than its dense parts.
+// Every brick also keeps its majorant, the highest density found anywhere in
+// it. hit() walks the bricks along the ray and samples collisions by delta
+// tracking against the majorant of each: empty bricks are crossed without a
+// single density lookup, and thin ones with steps as long as their own
+// majorant allows rather than that of the densest part of the volume.
+class grid_medium : public Hitable {
+    public:
+        // densities holds nx * ny * nz values, x first then y then z, in
+        // units of 1 / scale. brick is rounded up to a power of two.
+        grid_medium(const aabb &bounds, int nx, int ny, int nz,
+                    const std::vector<float> &densities, float scale, texture *a,
+                    int brick = 8);
+        virtual bool hit(const Ray& r, float t_min, float t_max, HitRecord& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            box = bounds;
+            return true;
+        }
+        // Interpolated density at p, scaled
+        float density(const vec3 &p) const;
+        // Fraction of the light going through the medium between t_min and
+        // t_max, estimated by ratio tracking against the same majorants
+        float transmittance(const Ray &r, float t_min, float t_max) const;
+        size_t storedBricks() const { return bricks.size() >> (3 * brickShift); }
+        size_t totalBricks() const { return majorants.size(); }
+
+        material *phase_function;
+
+    private:
+        // Calls visit(t0, t1, majorant) for every brick the ray crosses
+        // between t_min and t_max, in order, until it returns true. The
+        // majorant is per unit of t.
+        template <typename Visit>
+        void walk(const Ray &r, float t_min, float t_max, Visit &&visit) const;
+        float voxel(int x, int y, int z) const;
+
+        aabb bounds;
+        int n[3];
+        // Voxels per unit of length
+        vec3 toGrid;
+        int brickShift;
+        int bricksPerAxis[3];
+        // Start of every brick in bricks, -1 for empty ones
+        std::vector<int64_t> brickOffset;
+        std::vector<float> bricks;
+        std::vector<float> majorants;
+};
@@ -0,0 +1,253 @@
+#include "options.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "scene.h"
+
+static void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  -o, --output PATH     image to write, .ppm .png .exr or .pfm (img.ppm)\n"
+            << "  --resolution WxH      image size (800x800)\n"
+            << "  --scene NAME          built-in scene and its camera (final_scene), one of\n"
+            << "                        final_scene cornell_box cornell_smoke cornell_ball\n"
+            << "                        cornell_fog cornell_mesh random_scene earth\n"
+            << "                        textured_plane\n"
+            << "  --mesh PATH           OBJ or PLY mesh standing in the Cornell box, implies\n"
+            << "                        --scene cornell_mesh. Cached in PATH.cornell.rtc\n"
+            << "  --spp N               samples per pixel, 0 for no limit when progressive (100)\n"
+            << "  --tile N              tile size in pixels (16)\n"
+            << "  --tile-order ORDER    scanline, hilbert or spiral from the center (hilbert)\n"
+            << "  --cost-order          render the slowest tiles first\n"
+            << "  --crop X0,Y0,X1,Y1    render only the pixels with X0 <= x < X1 and\n"
+            << "                        Y0 <= y < Y1, y going down, and write just those\n"
+            << "  --full-frame          write the whole frame of a crop, black outside\n"
+            << "  --heatmap PATH        write the render time of every tile as an image\n"
+            << "  --trace PATH          write a Chrome trace of the tiles run by each thread\n"
+            << "  --node-heatmap PATH   write the BVH nodes visited per path of every pixel\n"
+            << "  --prim-heatmap PATH   write the primitives tested per path of every pixel\n"
+            << "  --bvh-report          print node count, depths, leaf sizes, SAH cost and\n"
+            << "                        overlap of the BVHs of the scene\n"
+            << "  --texture-cache MB    memory for tiles of image textures (1024)\n"
+            << "  --lookfrom X,Y,Z      camera position (278,278,-600)\n"
+            << "  --lookat X,Y,Z        point the camera looks at (278,278,0)\n"
+            << "  --up X,Y,Z            up direction of the camera (0,1,0)\n"
+            << "  --vfov DEGREES        vertical field of view (50)\n"
+            << "  --aperture D          lens diameter, 0 for a pinhole (0)\n"
+            << "  --focus-dist D        focus distance, 0 to focus on --lookat (0)\n"
+            << "  --progressive         render in passes over the whole image\n"
+            << "  --pass-spp N          samples per pixel of each progressive pass (1)\n"
+            << "  --time SECONDS        wall clock budget, implies --progressive\n"
+            << "  --preview SECONDS     interval between preview images, 0 for none (10)\n"
+            << "  --adaptive ERROR      stop sampling tiles whose error is below ERROR,\n"
+            << "                        e.g. 0.01, implies --progressive\n"
+            << "  --min-spp N           samples per pixel before a tile may stop (16)\n"
+            << "  --seed N              seed of the pixel samples (0)\n"
+            << "  --checkpoint PATH     save the render state to PATH while rendering\n"
+            << "  --checkpoint-interval SECONDS\n"
+            << "                        time between checkpoints (60)\n"
+            << "  --resume              continue from the --checkpoint file\n"
+            << "  --coordinator ADDRESS render on the workers connecting to ADDRESS,\n"
+            << "                        a socket path or HOST:PORT\n"
+            << "  --worker ADDRESS      render tiles for the coordinator on ADDRESS\n"
+            << "  --serve ADDRESS       keep the scene loaded and render the jobs sent to\n"
+            << "                        ADDRESS, or to stdin for -, one line of options each\n"
+            << "  --benchmark DIR       render the benchmark suite and compare every image\n"
+            << "                        with its reference in DIR, created when missing\n"
+            << "  --max-rmse E          largest difference to a reference that passes (0.01)\n";
+}
+
+static bool parseVector(const char *s, vec3 &v) {
+  float x, y, z;
+  if (std::sscanf(s, "%f,%f,%f", &x, &y, &z) != 3) {
+    return false;
+  }
+  v = vec3(x, y, z);
+  return true;
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  const SceneInfo *scene = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    // Every option but the flags takes a value
+    if (std::strcmp(arg, "--progressive") && std::strcmp(arg, "--resume") &&
+        std::strcmp(arg, "--full-frame") && std::strcmp(arg, "--cost-order") &&
+        std::strcmp(arg, "--bvh-report") && i + 1 >= argc) {
+      usage(argv[0]);
+      return false;
+    }
+    if (!std::strcmp(arg, "-o") || !std::strcmp(arg, "--output")) {
+      options.output = argv[++i];
+    } else if (!std::strcmp(arg, "--scene")) {
+      scene = findScene(argv[++i]);
+      if (!scene) {
+        std::cerr << "Unknown scene " << argv[i] << std::endl;
+        usage(argv[0]);
+        return false;
+      }
+      options.scene = scene->name;
+    } else if (!std::strcmp(arg, "--mesh")) {
+      options.mesh = argv[++i];
+      scene = findScene("cornell_mesh");
+      options.scene = scene->name;
+    } else if (!std::strcmp(arg, "--resolution")) {
+      if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2) {
+        usage(argv[0]);
+        return false;
+      }
+    } else if (!std::strcmp(arg, "--spp")) {
+      options.spp = std::atoi(argv[++i]);
+    } else if (!std::strcmp(arg, "--tile")) {
+      options.tileSize = std::atoi(argv[++i]);
+    } else if (!std::strcmp(arg, "--tile-order")) {
+      const char *order = argv[++i];
+      if (!std::strcmp(order, "scanline")) {
+        options.tileOrder = raytracer::TileOrder::Scanline;
+      } else if (!std::strcmp(order, "hilbert")) {
+        options.tileOrder = raytracer::TileOrder::Hilbert;
+      } else if (!std::strcmp(order, "spiral")) {
+        options.tileOrder = raytracer::TileOrder::Spiral;
+      } else {
+        usage(argv[0]);
+        return false;
+      }
+    } else if (!std::strcmp(arg, "--cost-order")) {
+      options.costOrder = true;
+    } else if (!std::strcmp(arg, "--crop")) {
+      Bounds2i &c = options.crop;
+      if (std::sscanf(argv[++i], "%d,%d,%d,%d", &c.min.x, &c.min.y, &c.max.x, &c.max.y) != 4 ||
+          c.empty()) {
+        usage(argv[0]);
+        return false;
+      }
+    } else if (!std::strcmp(arg, "--full-frame")) {
+      options.fullFrame = true;
+    } else if (!std::strcmp(arg, "--heatmap")) {
+      options.heatmap = argv[++i];
+    } else if (!std::strcmp(arg, "--trace")) {
+      options.trace = argv[++i];
+    } else if (!std::strcmp(arg, "--node-heatmap")) {
+      options.nodeHeatmap = argv[++i];
+    } else if (!std::strcmp(arg, "--prim-heatmap")) {
+      options.primHeatmap = argv[++i];
+    } else if (!std::strcmp(arg, "--bvh-report")) {
+      options.bvhReport = true;
+    } else if (!std::strcmp(arg, "--texture-cache")) {
+      options.textureCacheMB = std::atoi(argv[++i]);
+    } else if (!std::strcmp(arg, "--lookfrom")) {
+      if (!parseVector(argv[++i], options.lookFrom)) {
+        usage(argv[0]);
+        return false;
+      }
+      options.lookFromSet = true;
+    } else if (!std::strcmp(arg, "--lookat")) {
+      if (!parseVector(argv[++i], options.lookAt)) {
+        usage(argv[0]);
+        return false;
+      }
+      options.lookAtSet = true;
+    } else if (!std::strcmp(arg, "--up")) {
+      if (!parseVector(argv[++i], options.up)) {
+        usage(argv[0]);
+        return false;
+      }
+    } else if (!std::strcmp(arg, "--vfov")) {
+      options.vfov = std::atof(argv[++i]);
+      options.vfovSet = true;
+    } else if (!std::strcmp(arg, "--aperture")) {
+      options.aperture = std::atof(argv[++i]);
+    } else if (!std::strcmp(arg, "--focus-dist")) {
+      options.focusDistance = std::atof(argv[++i]);
+    } else if (!std::strcmp(arg, "--progressive")) {
+      options.progressive = true;
+    } else if (!std::strcmp(arg, "--pass-spp")) {
+      options.passSpp = std::atoi(argv[++i]);
+    } else if (!std::strcmp(arg, "--time")) {
+      options.timeBudget = std::atof(argv[++i]);
+      options.progressive = true;
+    } else if (!std::strcmp(arg, "--preview")) {
+      options.previewInterval = std::atof(argv[++i]);
+    } else if (!std::strcmp(arg, "--adaptive")) {
+      options.adaptiveThreshold = std::atof(argv[++i]);
+      options.progressive = true;
+    } else if (!std::strcmp(arg, "--min-spp")) {
+      options.minSpp = std::atoi(argv[++i]);
+    } else if (!std::strcmp(arg, "--seed")) {
+      options.seed = std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(arg, "--checkpoint")) {
+      options.checkpoint = argv[++i];
+    } else if (!std::strcmp(arg, "--checkpoint-interval")) {
+      options.checkpointInterval = std::atof(argv[++i]);
+    } else if (!std::strcmp(arg, "--resume")) {
+      options.resume = true;
+    } else if (!std::strcmp(arg, "--coordinator")) {
+      options.coordinator = argv[++i];
+    } else if (!std::strcmp(arg, "--worker")) {
+      options.worker = argv[++i];
+    } else if (!std::strcmp(arg, "--serve")) {
+      options.serve = argv[++i];
+    } else if (!std::strcmp(arg, "--benchmark")) {
+      options.benchmark = argv[++i];
+    } else if (!std::strcmp(arg, "--max-rmse")) {
+      options.maxRmse = std::atof(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return false;
+    }
+  }
+  // The camera of the scene, where the options do not set it
+  if (scene) {
+    if (!options.lookFromSet) {
+      options.lookFrom = scene->lookFrom;
+    }
+    if (!options.lookAtSet) {
+      options.lookAt = scene->lookAt;
+    }
+    if (!options.vfovSet) {
+      options.vfov = scene->vfov;
+    }
+  }
+  if (options.width <= 0 || options.height <= 0 || options.tileSize <= 0 ||
+      options.passSpp <= 0 || options.spp < 0 || options.minSpp < 2 ||
+      options.checkpointInterval <= 0.0 || (options.spp == 0 && !options.progressive) ||
+      options.vfov <= 0.f || options.vfov >= 180.f || options.textureCacheMB < 0) {
+    std::cerr << "Invalid options" << std::endl;
+    usage(argv[0]);
+    return false;
+  }
+  if (!options.crop.empty() &&
+      (options.crop.min.x < 0 || options.crop.min.y < 0 || options.crop.max.x > options.width ||
+       options.crop.max.y > options.height)) {
+    std::cerr << "The crop window must lie within the image" << std::endl;
+    return false;
+  }
+  if (options.resume && options.checkpoint.empty()) {
+    std::cerr << "--resume needs a --checkpoint file" << std::endl;
+    return false;
+  }
+  if (int(!options.coordinator.empty()) + int(!options.worker.empty()) +
+          int(!options.serve.empty()) + int(!options.benchmark.empty()) > 1) {
+    std::cerr << "A process is either a --coordinator, a --worker, a --serve or a --benchmark"
+              << std::endl;
+    return false;
+  }
+  if (options.progressive && options.spp == 0 && options.timeBudget <= 0.0) {
+    std::cerr << "Progressive rendering without --spp needs a --time budget" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+camera makeCamera(const Options &options) {
+  float focusDistance = options.focusDistance > 0.f ? options.focusDistance
+                                                    : (options.lookAt - options.lookFrom).length();
+  camera cam(options.lookFrom, options.lookAt, options.up, options.vfov,
+             float(options.width) / float(options.height), options.aperture, focusDistance, 0.0,
+             0.0);
+  cam.pixel_spread = 2.f * std::tan(options.vfov * float(M_PI) / 360.f) / options.height;
+  return cam;
+}
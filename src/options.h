@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "camera.h"
+#include "core/tile_order.h"
+
+// Command line options of the renderer
+struct Options {
+  // One of the built-in scenes, see sceneNames()
+  std::string scene = "final_scene";
+  // Mesh file of the cornell_mesh scene
+  std::string mesh;
+  int width = 800, height = 800;
+  // Samples per pixel. In progressive mode this is the target, 0 for no limit
+  int spp = 100;
+  int tileSize = 16;
+  raytracer::TileOrder tileOrder = raytracer::TileOrder::Hilbert;
+  // Hand out the most expensive tiles first, timed on a sparse pre-pass and
+  // then on every progressive pass
+  bool costOrder = false;
+  std::string output = "img.ppm";
+  // Only the tiles overlapping this pixel rectangle are rendered, empty for
+  // the whole image. The output is the crop, or the whole frame with the rest
+  // black when fullFrame is set.
+  Bounds2i crop;
+  bool fullFrame = false;
+
+  // Written at the end when set: the CPU time of every tile as an image, and
+  // a Chrome trace (chrome://tracing, Perfetto) of the tiles each thread ran
+  std::string heatmap;
+  std::string trace;
+  // BVH nodes visited and primitives tested per path of every pixel, as false
+  // color images. Only pixels rendered in this process are counted.
+  std::string nodeHeatmap, primHeatmap;
+  // Print the shape of the BVHs of the scene before rendering
+  bool bvhReport = false;
+  // Memory for the tiles of image textures read on demand, in MB
+  int textureCacheMB = 1024;
+
+  // Camera, looking from lookFrom towards lookAt with a vertical field of view
+  // of vfov degrees. A focus distance of 0 focuses on lookAt. --scene sets the
+  // camera of the scene, but only where no camera option set it, wherever it
+  // comes on the command line.
+  vec3 lookFrom = vec3(278, 278, -600), lookAt = vec3(278, 278, 0), up = vec3(0, 1, 0);
+  float vfov = 50.f;
+  bool lookFromSet = false, lookAtSet = false, vfovSet = false;
+  float aperture = 0.f, focusDistance = 0.f;
+
+  // Render in passes of passSpp samples over the whole image instead of all
+  // samples of a tile at once, writing a preview every previewInterval
+  // seconds. Stops at spp or once timeBudget seconds are spent.
+  bool progressive = false;
+  int passSpp = 1;
+  double timeBudget = 0.0;
+  double previewInterval = 10.0;
+
+  // Adaptive sampling, implies progressive. After minSpp samples, tiles
+  // whose error is below the threshold stop getting passes
+  // and spp becomes the limit of the others.
+  float adaptiveThreshold = 0.f;
+  int minSpp = 16;
+
+  // Every pixel sample is seeded from its pixel, its index and this seed
+  uint32_t seed = 0;
+
+  // When set, the render state is saved to this file every
+  // checkpointInterval seconds and when rendering stops. With resume the
+  // render continues from it, giving the same image as an uninterrupted run.
+  std::string checkpoint;
+  double checkpointInterval = 60.0;
+  bool resume = false;
+
+  // Distributed rendering. The coordinator listens on this address and hands
+  // tiles out to the workers connecting to it, without loading the scene. A
+  // worker takes the image settings from its coordinator.
+  std::string coordinator;
+  std::string worker;
+
+  // Keep the scene loaded and render the jobs sent to this address, or to
+  // stdin for "-". Every job is a line of options for one image.
+  std::string serve;
+
+  // Render the fixed benchmark suite instead, checking every image against
+  // the reference in this directory, which is created when missing
+  std::string benchmark;
+  float maxRmse = 0.01f;
+};
+
+// Prints the usage and returns false on invalid arguments
+bool parseOptions(int argc, char **argv, Options &options);
+
+camera makeCamera(const Options &options);
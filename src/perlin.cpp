@@ -1,35 +1,198 @@
 #include "perlin.h"
 
-static vec3* perlin_generate() {
-    vec3 * p = new vec3[256];
-    for (int i = 0; i < 256; ++i) {
-        p[i] = unit_vector(vec3(-1 + 2*drand48(),
-                                -1 + 2*drand48(),
-                                -1 + 2*drand48()));
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// The 48 bit linear congruential generator of drand48, started from the
+// zero state glibc gives it before any srand48. The tables used to be filled
+// from drand48 during static initialization; drawing the same numbers keeps
+// the noise of every scene as it was, without touching the global state.
+class Rand48 {
+public:
+    double next() {
+        state = (state * 0x5DEECE66Dull + 0xB) & ((1ull << 48) - 1);
+        return state * 0x1p-48;
+    }
+
+private:
+    uint64_t state = 0;
+};
+
+void permute(uint8_t *p, Rand48 &rng) {
+    for (int i = 0; i < 256; i++)
+        p[i] = i;
+    for (int i = 255; i > 0; i--) {
+        int target = int(rng.next() * (i + 1));
+        std::swap(p[i], p[target]);
     }
-    return p;
 }
 
-void permute(int *p, int n) {
-    for (int i = n - 1; i > 0; i--) {
-        int target = int(drand48() * (i + 1));
-        int tmp = p[i];
-        p[i]= p[target];
-        p[target] = tmp;
+}  // namespace
+
+const PerlinTables &PerlinTables::get() {
+    // Built by the first caller, the others wait for it
+    static const PerlinTables tables = [] {
+        PerlinTables t;
+        Rand48 rng;
+        for (int i = 0; i < 256; ++i) {
+            // z first, the order GCC evaluated the arguments in before
+            double z = -1 + 2*rng.next();
+            double y = -1 + 2*rng.next();
+            double x = -1 + 2*rng.next();
+            t.ranvec[i] = unit_vector(vec3(x, y, z));
+        }
+        permute(t.perm_x, rng);
+        permute(t.perm_y, rng);
+        permute(t.perm_z, rng);
+        return t;
+    }();
+    return tables;
+}
+
+#if defined(__SSE2__)
+
+// Rounds every lane down, for |x| < 2^31 like the int conversion of noise()
+static inline __m128 floor4(__m128 x) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+}
+
+// perlin::noise of four points at once. The arithmetic follows
+// perline_interp operation by operation, so every lane gets the same bits;
+// only the gradient lookups stay scalar, SSE2 has no gather.
+static __m128 noise4(const PerlinTables &t, __m128 x, __m128 y, __m128 z) {
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 fx = floor4(x), fy = floor4(y), fz = floor4(z);
+    __m128 u = _mm_sub_ps(x, fx), v = _mm_sub_ps(y, fy), w = _mm_sub_ps(z, fz);
+    alignas(16) int32_t i[4], j[4], k[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(i), _mm_cvttps_epi32(fx));
+    _mm_store_si128(reinterpret_cast<__m128i *>(j), _mm_cvttps_epi32(fy));
+    _mm_store_si128(reinterpret_cast<__m128i *>(k), _mm_cvttps_epi32(fz));
+    // The permutations of both lattice planes along every axis
+    int px[2][4], py[2][4], pz[2][4];
+    for (int l = 0; l < 4; ++l) {
+        for (int d = 0; d < 2; ++d) {
+            px[d][l] = t.perm_x[(i[l] + d) & 255];
+            py[d][l] = t.perm_y[(j[l] + d) & 255];
+            pz[d][l] = t.perm_z[(k[l] + d) & 255];
+        }
+    }
+
+    auto fade = [](__m128 t) {
+        return _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(_mm_set1_ps(3.f),
+                                                       _mm_mul_ps(_mm_set1_ps(2.f), t)));
+    };
+    __m128 weights[3][2];
+    __m128 offsets[3][2] = {{u, _mm_sub_ps(u, one)}, {v, _mm_sub_ps(v, one)},
+                            {w, _mm_sub_ps(w, one)}};
+    __m128 faded[3] = {fade(u), fade(v), fade(w)};
+    for (int a = 0; a < 3; ++a) {
+        weights[a][0] = _mm_sub_ps(one, faded[a]);
+        weights[a][1] = faded[a];
     }
-    return;
+
+    __m128 accum = _mm_setzero_ps();
+    for (int di = 0; di < 2; di++)
+        for (int dj = 0; dj < 2; dj++)
+            for (int dk = 0; dk < 2; dk++) {
+                alignas(16) float gx[4], gy[4], gz[4];
+                for (int l = 0; l < 4; ++l) {
+                    const vec3 &g = t.ranvec[px[di][l] ^ py[dj][l] ^ pz[dk][l]];
+                    gx[l] = g.x();
+                    gy[l] = g.y();
+                    gz[l] = g.z();
+                }
+                __m128 d = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_load_ps(gx), offsets[0][di]),
+                               _mm_mul_ps(_mm_load_ps(gy), offsets[1][dj])),
+                    _mm_mul_ps(_mm_load_ps(gz), offsets[2][dk]));
+                __m128 weight = _mm_mul_ps(_mm_mul_ps(weights[0][di], weights[1][dj]),
+                                           weights[2][dk]);
+                accum = _mm_add_ps(accum, _mm_mul_ps(weight, d));
+            }
+    return accum;
 }
 
-static int* perlin_generate_perm() {
-    int * p = new int[256];
-    for (int i = 0; i < 256; i++)
-        p[i] = i;
-    permute(p, 256);
-    return p;
+float perlin::turb(const vec3& p, int depth) const {
+    float accum = 0;
+    vec3 temp_p = p;
+    float weight = 1.0;
+    for (int octave = 0; octave < depth; octave += 4) {
+        int lanes = std::min(4, depth - octave);
+        alignas(16) float x[4], y[4], z[4], n[4];
+        for (int l = 0; l < 4; ++l) {
+            x[l] = temp_p.x();
+            y[l] = temp_p.y();
+            z[l] = temp_p.z();
+            if (l + 1 < lanes) {
+                temp_p *= 2;
+            }
+        }
+        temp_p *= 2;
+        _mm_store_ps(n, noise4(*tables, _mm_load_ps(x), _mm_load_ps(y), _mm_load_ps(z)));
+        // In octave order, as the scalar sum
+        for (int l = 0; l < lanes; ++l) {
+            accum += weight*n[l];
+            weight *= 0.5;
+        }
+    }
+    return fabs(accum);
+}
+
+void perlin::turb(const vec3 *p, int count, float *out, int depth) const {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        alignas(16) float x[4], y[4], z[4], n[4];
+        for (int l = 0; l < 4; ++l) {
+            x[l] = p[i + l].x();
+            y[l] = p[i + l].y();
+            z[l] = p[i + l].z();
+        }
+        __m128 px = _mm_load_ps(x), py = _mm_load_ps(y), pz = _mm_load_ps(z);
+        __m128 accum = _mm_setzero_ps(), two = _mm_set1_ps(2.f);
+        float weight = 1.0;
+        for (int octave = 0; octave < depth; ++octave) {
+            __m128 noise = noise4(*tables, px, py, pz);
+            accum = _mm_add_ps(accum, _mm_mul_ps(_mm_set1_ps(weight), noise));
+            weight *= 0.5;
+            px = _mm_mul_ps(px, two);
+            py = _mm_mul_ps(py, two);
+            pz = _mm_mul_ps(pz, two);
+        }
+        _mm_store_ps(n, accum);
+        for (int l = 0; l < 4; ++l) {
+            out[i + l] = fabs(n[l]);
+        }
+    }
+    for (; i < count; ++i) {
+        out[i] = turb(p[i], depth);
+    }
+}
+
+#else
+
+float perlin::turb(const vec3& p, int depth) const {
+    float accum = 0;
+    vec3 temp_p = p;
+    float weight = 1.0;
+    for (int i = 0; i < depth; i++) {
+        accum += weight*noise(temp_p);
+        weight *= 0.5;
+        temp_p *= 2;
+    }
+    return fabs(accum);
+}
+
+void perlin::turb(const vec3 *p, int count, float *out, int depth) const {
+    for (int i = 0; i < count; ++i) {
+        out[i] = turb(p[i], depth);
+    }
 }
 
-// float *perlin::ranfloat = perlin_generate();
-vec3 *perlin::ranvec = perlin_generate();
-int *perlin::perm_x = perlin_generate_perm();
-int *perlin::perm_y = perlin_generate_perm();
-int *perlin::perm_z = perlin_generate_perm();
+#endif
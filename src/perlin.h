@@ -1,6 +1,8 @@
 #ifndef PERLINH
 #define PERLINH
 
+#include <cstdint>
+
 #include "geometry.h"
 
 inline float perline_interp(vec3 c[2][2][2], float u, float v, float w) {
@@ -20,8 +22,22 @@ inline float perline_interp(vec3 c[2][2][2], float u, float v, float w) {
     return accum;
 }
 
+// Gradients and lattice permutations of the noise, 4 KB in one cache
+// aligned block so a lookup touches a single contiguous table
+struct alignas(64) PerlinTables {
+    vec3 ranvec[256];
+    uint8_t perm_x[256];
+    uint8_t perm_y[256];
+    uint8_t perm_z[256];
+
+    // Built from a fixed seed on first use, the same in every run and
+    // process, and shared by all perlin objects
+    static const PerlinTables &get();
+};
+
 class perlin {
     public:
+        perlin() : tables(&PerlinTables::get()) {}
         float noise(const vec3& p) const {
             float u = p.x() - floor(p.x());
             float v = p.y() - floor(p.y());
@@ -33,26 +49,21 @@ class perlin {
             for (int di = 0; di < 2; di++)
                 for (int dj = 0; dj < 2; dj++)
                     for (int dk = 0; dk < 2; dk++)
-                        c[di][dj][dk] = ranvec[perm_x[(i + di) & 255] ^
-                                               perm_y[(j + dj) & 255] ^
-                                               perm_z[(k + dk) & 255]];
+                        c[di][dj][dk] = tables->ranvec[tables->perm_x[(i + di) & 255] ^
+                                                       tables->perm_y[(j + dj) & 255] ^
+                                                       tables->perm_z[(k + dk) & 255]];
             return perline_interp(c, u, v, w);
         }
-        float turb(const vec3& p, int depth=7) const {
-            float accum = 0;
-            vec3 temp_p = p;
-            float weight = 1.0;
-            for (int i = 0; i < depth; i++) {
-                accum += weight*noise(temp_p);
-                weight *= 0.5;
-                temp_p *= 2;
-            }
-            return fabs(accum);
-        }
+        // Sum of depth octaves of noise, each at twice the frequency and
+        // half the weight of the one before. With SSE2 four octaves are
+        // evaluated at once, one per lane, giving the same bits as the
+        // scalar noise.
+        float turb(const vec3& p, int depth=7) const;
+        // turb of count points into out, with SSE2 four points at once, one
+        // per lane
+        void turb(const vec3 *p, int count, float *out, int depth=7) const;
 
-        static vec3 *ranvec;
-        static int *perm_x;
-        static int *perm_y;
-        static int *perm_z;
+    private:
+        const PerlinTables *tables;
 };
 #endif
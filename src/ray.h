@@ -6,6 +6,8 @@ class Ray {
     public:
         Ray() {}
         Ray(const vec3& a, const vec3& b, float ti = 0.0) : A(a), B(b), _time(ti) {}
+        // Width of the ray cone at distance d along the ray
+        float coneWidthAt(float d) const { return coneWidth + coneSpread * d; }
         vec3 origin() const { return A; }
         vec3 direction() const { return B; }
         float time() const { return _time; }
@@ -13,5 +15,9 @@ class Ray {
         vec3 A;
         vec3 B;
         float _time;
+        // Ray differentials as a cone: its width at the origin and its growth
+        // per unit of distance. The camera starts it at the pixel footprint,
+        // texture lookups use it to filter over the area a sample covers.
+        float coneWidth = 0.f, coneSpread = 0.f;
 };
 #endif
@@ -10,6 +10,8 @@ bool xy_rect::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
         return false;
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (y - y0) / (y1 - y0);
+    rec.dpdu = x1 - x0;
+    rec.dpdv = y1 - y0;
     rec.t = t;
     rec.mat_ptr = mp;
     rec.p = r.point_at_parameter(t);
@@ -27,6 +29,8 @@ bool xz_rect::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
         return false;
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (z - z0) / (z1 - z0);
+    rec.dpdu = x1 - x0;
+    rec.dpdv = z1 - z0;
     rec.t = t;
     rec.mat_ptr = mp;
     rec.p = r.point_at_parameter(t);
@@ -44,6 +48,8 @@ bool yz_rect::hit(const Ray& r, float t0, float t1, HitRecord& rec) const {
         return false;
     rec.u = (y - y0) / (y1 - y0);
     rec.v = (z - z0) / (z1 - z0);
+    rec.dpdu = y1 - y0;
+    rec.dpdv = z1 - z0;
     rec.t = t;
     rec.mat_ptr = mp;
     rec.p = r.point_at_parameter(t);
@@ -0,0 +1,529 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+#include "core/parallel.h"
+#include "core/perf_counters.h"
+#include "core/rng.h"
+#include "core/tile_order.h"
+#include "distributed.h"
+#include "io/checkpoint.h"
+#include "io/texture_cache.h"
+#include "material.h"
+#include "pdf.h"
+
+static vec3 color(const Ray &r, Hitable *world, Hitable *light, int depth) {
+  HitRecord hrec;
+  // 0.001 for avoiding t close to 0
+  if (world->hit(r, 0.001, FLT_MAX, hrec)) {
+    // Footprint of the ray cone on the surface, for texture filtering, which
+    // stretches as the ray grazes the surface. The bounces continue the cone
+    // from there with the same spread, ignoring the curvature of the surface
+    // and the roughness of the material.
+    float length = r.direction().length();
+    float width = r.coneWidthAt(hrec.t * length);
+    float cosine = std::max(std::abs(dot(r.direction(), hrec.normal)) / length, 0.01f);
+    hrec.du = hrec.dpdu > 0.f ? width / (cosine * hrec.dpdu) : 0.f;
+    hrec.dv = hrec.dpdv > 0.f ? width / (cosine * hrec.dpdv) : 0.f;
+    scatter_record srec;
+    vec3 emitted = hrec.mat_ptr->emitted(r, hrec, hrec.u, hrec.v, hrec.p);
+    if (depth < 5 && hrec.mat_ptr->scatter(r, hrec, &srec)) {
+      // For specular, we don't care about the pdf distribution
+      if (srec.is_specular) {
+        ++raytracer::threadStats().specularRays;
+        srec.specular_ray.coneWidth = width;
+        srec.specular_ray.coneSpread = r.coneSpread;
+        return srec.attenuation * color(srec.specular_ray, world, light, depth + 1);
+      }
+      // Calculate scatter ray
+      vec3 v = light->random(hrec.p);
+      Ray scattered = Ray(hrec.p, v, r.time());
+      scattered.coneWidth = width;
+      scattered.coneSpread = r.coneSpread;
+      float incidentPdf = light->pdf_value(hrec.p, scattered.direction());
+      float scatterPdf = hrec.mat_ptr->scattering_pdf(r, hrec, scattered);
+      ++raytracer::threadStats().diffuseRays;
+      emitted += srec.attenuation * color(scattered, world, light, depth + 1) *
+                 scatterPdf / incidentPdf;
+    }
+    return emitted;
+  }
+  return vec3(0.f);
+}
+
+static double secondsBetween(Renderer::Clock::time_point a, Renderer::Clock::time_point b) {
+  return std::chrono::duration<double>(b - a).count();
+}
+
+std::atomic<bool> Renderer::stopRequested(false);
+
+Renderer::Renderer(const Scene *scene, const camera &cam, const Options &options)
+    : scene(scene),
+      cam(cam),
+      options(options),
+      film(options.width, options.height),
+      maxSpp(options.spp > 0 ? options.spp : std::numeric_limits<int>::max()),
+      totalSamples(0),
+      created(Clock::now()) {
+  // The tiles of a crop are those of the full image that overlap it, rendered
+  // whole so every pixel gets exactly the samples of a full render, adaptive
+  // sampling included
+  int ts = options.tileSize;
+  Bounds2i region = options.crop.empty() ? film.getBounds() : options.crop;
+  for (int y = region.min.y / ts * ts; y < region.max.y; y += ts) {
+    for (int x = region.min.x / ts * ts; x < region.max.x; x += ts) {
+      tiles.emplace_back(Point2i(x, y), Point2i(std::min(x + ts, options.width),
+                                                std::min(y + ts, options.height)));
+    }
+  }
+  tileSpp.assign(tiles.size(), 0);
+  tileCost.assign(tiles.size(), 0.f);
+  tileSeconds.assign(tiles.size(), 0.0);
+  tileStats.assign(tiles.size(), raytracer::RayStats());
+  if (!options.nodeHeatmap.empty() || !options.primHeatmap.empty()) {
+    pixelStats.resize(size_t(options.width) * options.height);
+  }
+  tileRank = raytracer::tileRanks(tiles, ts, options.tileOrder);
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    activeTiles.push_back(i);
+  }
+  sortActiveTiles();
+}
+
+raytracer::Image Renderer::getImage() const {
+  if (options.crop.empty()) {
+    return film.getImage();
+  }
+  raytracer::Image crop = film.getImage(options.crop);
+  if (!options.fullFrame) {
+    return crop;
+  }
+  raytracer::Image image(options.width, options.height);
+  for (int y = 0; y < crop.getHeight(); ++y) {
+    for (int x = 0; x < crop.getWidth(); ++x) {
+      image(options.crop.min.x + x, options.crop.min.y + y) = crop(x, y);
+    }
+  }
+  return image;
+}
+
+// Black, blue, red, yellow, white
+static vec3 heatColor(float t) {
+  const vec3 stops[] = {vec3(0.f), vec3(0.f, 0.f, 1.f), vec3(1.f, 0.f, 0.f), vec3(1.f, 1.f, 0.f),
+                        vec3(1.f)};
+  float x = std::min(std::max(t, 0.f), 1.f) * 4.f;
+  int i = std::min(int(x), 3);
+  vec3 c = stops[i] + (x - i) * (stops[i + 1] - stops[i]);
+  // Images are linear and written with gamma 2
+  return c * c;
+}
+
+raytracer::Image Renderer::getCostHeatmap() const {
+  std::vector<double> perPixel(tiles.size());
+  double maxCost = 0.0;
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    perPixel[i] = tileSeconds[i] / tiles[i].area();
+    maxCost = std::max(maxCost, perPixel[i]);
+  }
+  raytracer::Image image(options.width, options.height);
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    vec3 c = heatColor(maxCost > 0.0 ? float(perPixel[i] / maxCost) : 0.f);
+    for (int y = tiles[i].min.y; y < tiles[i].max.y; ++y) {
+      for (int x = tiles[i].min.x; x < tiles[i].max.x; ++x) {
+        image(x, y) = c;
+      }
+    }
+  }
+  return image;
+}
+
+raytracer::Image Renderer::getTraversalHeatmap(bool primitives) const {
+  if (pixelStats.empty()) {
+    return raytracer::Image();
+  }
+  // Every path starts with one camera ray
+  auto perPath = [&](const raytracer::RayStats &s) {
+    uint64_t count = primitives ? s.primitivesTested : s.nodesVisited;
+    return s.cameraRays > 0 ? float(count) / s.cameraRays : 0.f;
+  };
+  float maxValue = 0.f;
+  double sum = 0.0;
+  int64_t pixels = 0;
+  for (const raytracer::RayStats &s : pixelStats) {
+    maxValue = std::max(maxValue, perPath(s));
+    sum += perPath(s);
+    pixels += s.cameraRays > 0;
+  }
+  std::cout << (primitives ? "Primitives tested" : "Nodes visited")
+            << " per path: mean " << (pixels > 0 ? sum / pixels : 0.0) << ", max " << maxValue
+            << std::endl;
+  raytracer::Image image(options.width, options.height);
+  for (int y = 0; y < options.height; ++y) {
+    for (int x = 0; x < options.width; ++x) {
+      float v = perPath(pixelStats[size_t(y) * options.width + x]);
+      image(x, y) = heatColor(maxValue > 0.f ? v / maxValue : 0.f);
+    }
+  }
+  return image;
+}
+
+raytracer::RayStats Renderer::getStats() const {
+  raytracer::RayStats total;
+  for (const raytracer::RayStats &s : tileStats) {
+    total += s;
+  }
+  return total;
+}
+
+double Renderer::getCpuSeconds() const {
+  double seconds = 0.0;
+  for (double s : tileSeconds) {
+    seconds += s;
+  }
+  return seconds;
+}
+
+// Complete events in the Trace Event Format, one row per thread, with
+// timestamps in microseconds
+bool Renderer::writeTrace(const std::string &path) const {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file) {
+    std::cerr << "Open file failed: " << path << std::endl;
+    return false;
+  }
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < traceEvents.size(); ++i) {
+    const raytracer::TileEvent &e = traceEvents[i];
+    const Bounds2i &b = tiles[e.tile];
+    fprintf(file,
+            "{\"name\":\"tile %d\",\"cat\":\"tile\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"x\":%d,\"y\":%d,\"spp\":%d,"
+            "\"rays\":%llu,\"nodes\":%llu,\"primitives\":%llu}}%s\n",
+            e.tile, e.thread, e.start * 1e6, e.duration * 1e6, b.min.x, b.min.y, e.spp,
+            (unsigned long long)e.stats.rays(), (unsigned long long)e.stats.nodesVisited,
+            (unsigned long long)e.stats.primitivesTested, i + 1 < traceEvents.size() ? "," : "");
+  }
+  fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+  if (fclose(file) != 0) {
+    std::cerr << "Writing " << path << " failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int Renderer::getSamplesPerPixel() const {
+  return tileSpp.empty() ? 0 : *std::max_element(tileSpp.begin(), tileSpp.end());
+}
+
+vec3 Renderer::samplePixel(int x, int y, int sample) const {
+  int nx = options.width, ny = options.height;
+  uint64_t pixelIndex = uint64_t(y) * nx + x;
+  raytracer::threadRNG().setSequence(
+      raytracer::mixBits((pixelIndex << 32 | uint32_t(sample)) ^ raytracer::mixBits(options.seed)));
+  // Film rows go down, the camera v goes up
+  float u = float(x + random_float()) / nx;
+  float v = 1.f - float(y + random_float()) / ny;
+  Ray r = cam.get_ray(u, v);
+  ++raytracer::threadStats().cameraRays;
+  vec3 c = color(r, scene->world, scene->light, 0);
+  de_nan(c);
+  return c;
+}
+
+raytracer::FilmTile Renderer::traceTile(const Bounds2i &bounds, int firstSample, int spp,
+                                        raytracer::RayStats *pixelStats) const {
+  raytracer::FilmTile tile = film.getTile(bounds);
+  for (int y = bounds.min.y; y < bounds.max.y; y++) {
+    for (int x = bounds.min.x; x < bounds.max.x; x++) {
+      raytracer::RayStats before = raytracer::threadStats();
+      for (int s = firstSample; s < firstSample + spp; s++) {
+        tile.addSample(x, y, samplePixel(x, y, s));
+      }
+      if (pixelStats) {
+        pixelStats[size_t(y) * options.width + x] += raytracer::threadStats() - before;
+      }
+    }
+  }
+  return tile;
+}
+
+void Renderer::estimateCosts() {
+  // One sample of every 4th pixel in x and y, 1/16 spp in all, thrown away
+  const int kStride = 4;
+  raytracer::ParallelFor(
+      [&](int i) {
+        const Bounds2i &bounds = tiles[activeTiles[i]];
+        double start = raytracer::threadCpuSeconds();
+        for (int y = bounds.min.y; y < bounds.max.y; y += kStride) {
+          for (int x = bounds.min.x; x < bounds.max.x; x += kStride) {
+            samplePixel(x, y, 0);
+          }
+        }
+        tileCost[activeTiles[i]] = (raytracer::threadCpuSeconds() - start) * kStride * kStride;
+      },
+      activeTiles.size(), 1);
+}
+
+void Renderer::sortActiveTiles() {
+  // Most expensive first, so that no thread picks up a slow tile just before
+  // the end of a pass while the others run out of work
+  std::stable_sort(activeTiles.begin(), activeTiles.end(), [&](int a, int b) {
+    if (options.costOrder && tileCost[a] != tileCost[b]) {
+      return tileCost[a] > tileCost[b];
+    }
+    return tileRank[a] < tileRank[b];
+  });
+}
+
+void Renderer::recordTile(int tileIndex, int spp, double seconds,
+                          const raytracer::RayStats &stats) {
+  // CPU seconds per sample of the whole tile, its cost in the next pass
+  tileCost[tileIndex] = seconds / spp;
+  tileSeconds[tileIndex] += seconds;
+  tileStats[tileIndex] += stats;
+  std::call_once(firstTile,
+                 [this] { firstTileSeconds = secondsBetween(renderStart, Clock::now()); });
+}
+
+void Renderer::renderTile(int tileIndex, int spp) {
+  const Bounds2i &bounds = tiles[tileIndex];
+  Clock::time_point wallStart = Clock::now();
+  double start = raytracer::threadCpuSeconds();
+  raytracer::RayStats before = raytracer::threadStats();
+  raytracer::FilmTile tile = [&] {
+    raytracer::PerfScope perf(raytracer::PerfPhase::Render);
+    return traceTile(bounds, tileSpp[tileIndex], spp,
+                     pixelStats.empty() ? nullptr : pixelStats.data());
+  }();
+  raytracer::RayStats stats = raytracer::threadStats() - before;
+  recordTile(tileIndex, spp, raytracer::threadCpuSeconds() - start, stats);
+  // Tiles of one pass never overlap, so merging needs no lock
+  film.mergeTile(tile);
+  tileSpp[tileIndex] += spp;
+  totalSamples += int64_t(bounds.area()) * spp;
+  if (!options.trace.empty()) {
+    Clock::time_point wallEnd = Clock::now();
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceEvents.push_back({tileIndex, raytracer::threadIndex, spp,
+                           secondsBetween(created, wallStart),
+                           secondsBetween(wallStart, wallEnd), stats});
+  }
+}
+
+bool Renderer::renderPassRemote(int spp, Clock::time_point deadline) {
+  std::vector<TileTask> tasks;
+  for (int tile : activeTiles) {
+    tasks.push_back({tile, tiles[tile], tileSpp[tile], std::min(spp, maxSpp - tileSpp[tile])});
+  }
+  return coordinator->run(tasks, deadline, stopRequested,
+                          [this](const TileResult &result, raytracer::FilmTile &tile) {
+                            const TileTask &task = result.task;
+                            recordTile(task.tile, task.spp, result.seconds, result.stats);
+                            film.mergeTile(tile);
+                            tileSpp[task.tile] += task.spp;
+                            totalSamples += int64_t(task.bounds.area()) * task.spp;
+                          });
+}
+
+bool Renderer::renderPass(int spp, Clock::time_point deadline) {
+  if (coordinator) {
+    return renderPassRemote(spp, deadline);
+  }
+  std::atomic<int> skipped(0);
+  raytracer::ParallelFor(
+      [&](int i) {
+        if (stopRequested || Clock::now() >= deadline) {
+          skipped++;
+          return;
+        }
+        int tile = activeTiles[i];
+        renderTile(tile, std::min(spp, maxSpp - tileSpp[tile]));
+      },
+      activeTiles.size(), 1);
+  return skipped == 0;
+}
+
+void Renderer::updateActiveTiles() {
+  bool adaptive = options.adaptiveThreshold > 0.f;
+  activeTiles.erase(std::remove_if(activeTiles.begin(), activeTiles.end(),
+                                   [&](int i) {
+                                     return tileSpp[i] >= maxSpp ||
+                                            (adaptive && tileSpp[i] >= options.minSpp &&
+                                             film.getError(tiles[i]) <=
+                                                 options.adaptiveThreshold);
+                                   }),
+                    activeTiles.end());
+}
+
+bool Renderer::saveCheckpoint(const std::string &path) const {
+  RenderCheckpoint c;
+  c.width = options.width;
+  c.height = options.height;
+  c.tileSize = options.tileSize;
+  c.crop = options.crop;
+  c.spp = options.spp;
+  c.passSpp = options.passSpp;
+  c.minSpp = options.minSpp;
+  c.progressive = options.progressive;
+  c.seed = options.seed;
+  c.adaptiveThreshold = options.adaptiveThreshold;
+  c.scene = options.scene;
+  c.mesh = options.mesh;
+  c.lookFrom = options.lookFrom;
+  c.lookAt = options.lookAt;
+  c.up = options.up;
+  c.vfov = options.vfov;
+  c.aperture = options.aperture;
+  c.focusDistance = options.focusDistance;
+  c.elapsed = elapsedBefore;
+  c.tileSpp.assign(tileSpp.begin(), tileSpp.end());
+  c.tileActive.assign(tiles.size(), 0);
+  for (int i : activeTiles) {
+    c.tileActive[i] = 1;
+  }
+  c.pixels = film.getPixels();
+  return writeCheckpoint(path, c);
+}
+
+bool Renderer::loadCheckpoint(const std::string &path) {
+  RenderCheckpoint c;
+  if (!readCheckpoint(path, c)) {
+    return false;
+  }
+  // Anything that changes which samples are taken must match
+  auto sameVector = [](const vec3 &a, const vec3 &b) {
+    return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+  };
+  if (c.scene != options.scene || c.mesh != options.mesh ||
+      !sameVector(c.lookFrom, options.lookFrom) || !sameVector(c.lookAt, options.lookAt) ||
+      !sameVector(c.up, options.up) || c.vfov != options.vfov || c.aperture != options.aperture ||
+      c.focusDistance != options.focusDistance || c.width != options.width ||
+      c.height != options.height || c.tileSize != options.tileSize || c.crop != options.crop ||
+      c.spp != options.spp || c.passSpp != options.passSpp || c.minSpp != options.minSpp ||
+      c.progressive != uint32_t(options.progressive) || c.seed != options.seed ||
+      c.adaptiveThreshold != options.adaptiveThreshold || c.tileSpp.size() != tiles.size()) {
+    std::cerr << "Checkpoint " << path << " was made with other render settings" << std::endl;
+    return false;
+  }
+  film.getPixels() = std::move(c.pixels);
+  tileSpp.assign(c.tileSpp.begin(), c.tileSpp.end());
+  activeTiles.clear();
+  totalSamples = 0;
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    if (c.tileActive[i]) {
+      activeTiles.push_back(i);
+    }
+    totalSamples += int64_t(tiles[i].area()) * tileSpp[i];
+  }
+  sortActiveTiles();
+  elapsedBefore = c.elapsed;
+  return true;
+}
+
+void Renderer::render(AsyncImageWriter &writer) {
+  auto toDuration = [](double seconds) {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  };
+  Clock::time_point start = Clock::now(), lastPreview = start, lastCheckpoint = start;
+  renderStart = start;
+  Clock::time_point deadline = Clock::time_point::max();
+  if (options.progressive && options.timeBudget > 0.0) {
+    deadline = start + toDuration(options.timeBudget - elapsedBefore);
+  }
+  bool checkpointing = !options.checkpoint.empty();
+  auto checkpoint = [&](Clock::time_point now) {
+    elapsedBefore += secondsBetween(lastCheckpoint, now);
+    lastCheckpoint = now;
+    saveCheckpoint(options.checkpoint);
+  };
+
+  // Workers do not report their timings, remote passes keep the tile order
+  if (options.costOrder && !coordinator) {
+    estimateCosts();
+    sortActiveTiles();
+  }
+  while (!activeTiles.empty() && !stopRequested) {
+    Clock::time_point passDeadline = deadline;
+    if (!options.progressive) {
+      // All samples of a tile at once. To checkpoint, the pass is cut at the
+      // interval and continued with the tiles not rendered yet.
+      passDeadline = checkpointing ? lastCheckpoint + toDuration(options.checkpointInterval)
+                                   : Clock::time_point::max();
+    } else if (std::find(tileSpp.begin(), tileSpp.end(), 0) != tileSpp.end()) {
+      // The first pass always completes so that every pixel has a sample.
+      // Later passes stop starting tiles at the deadline, the pixels they miss
+      // just average fewer samples.
+      passDeadline = Clock::time_point::max();
+    }
+    bool complete = renderPass(options.progressive ? options.passSpp : maxSpp, passDeadline);
+    updateActiveTiles();
+    if (options.costOrder && !coordinator) {
+      sortActiveTiles();
+    }
+    Clock::time_point now = Clock::now();
+    if (options.progressive && (!complete || now >= deadline)) {
+      break;
+    }
+    if (options.progressive && options.previewInterval > 0.0 &&
+        secondsBetween(lastPreview, now) >= options.previewInterval) {
+      std::cout << "Preview at " << getSamplesPerPixel() << " spp, " << std::setprecision(3)
+                << secondsBetween(start, now) << "s" << std::endl;
+      writer.write(options.output, getImage());
+      lastPreview = now;
+    }
+    if (checkpointing && !activeTiles.empty() &&
+        secondsBetween(lastCheckpoint, now) >= options.checkpointInterval) {
+      checkpoint(now);
+    }
+  }
+  if (checkpointing) {
+    checkpoint(Clock::now());
+  }
+  std::cout << (stopRequested ? "Stopped at " : "Completed ") << getSamplesPerPixel()
+            << " spp in " << std::setprecision(3) << secondsBetween(start, Clock::now()) << "s";
+  if (stopRequested && checkpointing) {
+    std::cout << ", continue with --resume";
+  }
+  std::cout << std::endl;
+  if (options.adaptiveThreshold > 0.f) {
+    int64_t pixels = 0;
+    for (const Bounds2i &tile : tiles) {
+      pixels += tile.area();
+    }
+    std::cout << "Converged tiles: " << tiles.size() - activeTiles.size() << "/" << tiles.size()
+              << ", average spp: " << double(totalSamples) / pixels << std::endl;
+  }
+  raytracer::RayStats stats = getStats();
+  if (stats.rays() > 0) {
+    std::cout << "Rays: " << stats.cameraRays << " camera, " << stats.specularRays
+              << " specular, " << stats.diffuseRays << " diffuse; per ray "
+              << double(stats.nodesVisited) / stats.rays() << " nodes, "
+              << double(stats.primitivesTested) / stats.rays() << " primitives" << std::endl;
+  }
+  TextureCache::Stats textures = TextureCache::instance().getStats();
+  if (textures.misses > 0) {
+    std::cout << "Texture tiles: " << textures.misses << " read, " << textures.hits << " hits, "
+              << textures.evictions << " evicted; peak " << textures.peakBytes / 1048576.0
+              << " of " << (TextureCache::instance().getBudget() >> 20) << " MB" << std::endl;
+  }
+  raytracer::printPerfCounters(std::cout, stats.rays());
+  writer.write(options.output, getImage());
+  if (!options.heatmap.empty()) {
+    writer.write(options.heatmap, getCostHeatmap());
+  }
+  if (!options.nodeHeatmap.empty()) {
+    writer.write(options.nodeHeatmap, getTraversalHeatmap(false));
+  }
+  if (!options.primHeatmap.empty()) {
+    writer.write(options.primHeatmap, getTraversalHeatmap(true));
+  }
+  if (!options.trace.empty()) {
+    writeTrace(options.trace);
+  }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "camera.h"
+#include "core/film.h"
+#include "core/stats.h"
+#include "io/image_io.h"
+#include "options.h"
+#include "scene.h"
+
+class RenderCoordinator;
+
+// Traces the camera rays of a scene into a Film, tile by tile on the thread
+// pool, either all samples at once or in progressive passes. Every tile
+// counts the samples taken so far, and the n-th sample of a pixel is always
+// seeded the same way, so renders can be cut short and continued, or split
+// between processes.
+class Renderer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // The scene may be null when a coordinator renders the tiles
+  Renderer(const Scene *scene, const camera &cam, const Options &options);
+  // Render the passes on the workers of coordinator instead of locally
+  void setCoordinator(RenderCoordinator *c) { coordinator = c; }
+
+  // Renders as configured by the options. In progressive mode previews are
+  // queued on writer while rendering, the final image is queued at the end.
+  void render(AsyncImageWriter &writer);
+  // Adds up to spp samples to every pixel of the tiles still active. Tiles
+  // not started by the deadline are skipped, returns false if any was.
+  bool renderPass(int spp, Clock::time_point deadline = Clock::time_point::max());
+  // Drops the tiles that reached the sample count, or whose error is below
+  // the adaptive threshold
+  void updateActiveTiles();
+  // Samples firstSample to firstSample + spp - 1 of the pixels in bounds.
+  // The work of each pixel is added to pixelStats, a full frame, if given.
+  raytracer::FilmTile traceTile(const Bounds2i &bounds, int firstSample, int spp,
+                                raytracer::RayStats *pixelStats = nullptr) const;
+
+  bool saveCheckpoint(const std::string &path) const;
+  // Fails if the checkpoint was made with other settings
+  bool loadCheckpoint(const std::string &path);
+  // Makes the render stop starting new tiles, save its checkpoint and write
+  // what it has. Safe to call from a signal handler.
+  static void requestStop() { stopRequested = true; }
+
+  const raytracer::Film &getFilm() const { return film; }
+  // The image to write, cropped when the options ask for it
+  raytracer::Image getImage() const;
+  // CPU time per pixel of every tile relative to the slowest, as a false
+  // color image from black through blue and red to yellow
+  raytracer::Image getCostHeatmap() const;
+  // BVH nodes visited, or primitives tested, per path of every pixel
+  // relative to the pixel with the most, in the same colors. Empty unless
+  // asked for in the options.
+  raytracer::Image getTraversalHeatmap(bool primitives) const;
+  // Summed over all tiles rendered so far, locally or by workers
+  raytracer::RayStats getStats() const;
+  // CPU time spent tracing tiles, summed over all threads and workers
+  double getCpuSeconds() const;
+  // Seconds from the start of render() until the first tile was done
+  double getFirstTileSeconds() const { return firstTileSeconds; }
+  // The most samples any pixel got so far
+  int getSamplesPerPixel() const;
+  int64_t getTotalSamples() const { return totalSamples; }
+  int getNumActiveTiles() const { return activeTiles.size(); }
+
+private:
+  vec3 samplePixel(int x, int y, int sample) const;
+  void renderTile(int tileIndex, int spp);
+  // Books the cost of a finished tile. Each tile is recorded by one thread
+  // at a time.
+  void recordTile(int tileIndex, int spp, double seconds, const raytracer::RayStats &stats);
+  bool writeTrace(const std::string &path) const;
+  // Times a sparse sample of every active tile, for ordering by cost before
+  // any tile was rendered
+  void estimateCosts();
+  // By cost when the options ask for it, otherwise in the tile order
+  void sortActiveTiles();
+  bool renderPassRemote(int spp, Clock::time_point deadline);
+
+  const Scene *scene;
+  RenderCoordinator *coordinator = nullptr;
+  camera cam;
+  Options options;
+  raytracer::Film film;
+  std::vector<Bounds2i> tiles;
+  // Samples per pixel taken in each tile
+  std::vector<int> tileSpp;
+  // Indices of the tiles that still get samples, in the order they are
+  // handed out
+  std::vector<int> activeTiles;
+  // Position of each tile in the tile order, and its last measured CPU
+  // seconds per sample of the whole tile
+  std::vector<int> tileRank;
+  std::vector<float> tileCost;
+  // CPU seconds and work of each tile over all its samples
+  std::vector<double> tileSeconds;
+  std::vector<raytracer::RayStats> tileStats;
+  // Work of every pixel, for the traversal heatmaps
+  std::vector<raytracer::RayStats> pixelStats;
+  // Every tile rendered, when a trace is asked for
+  std::vector<raytracer::TileEvent> traceEvents;
+  std::mutex traceMutex;
+  Clock::time_point renderStart;
+  std::once_flag firstTile;
+  double firstTileSeconds = 0.0;
+  int maxSpp;
+  std::atomic<int64_t> totalSamples;
+  // Origin of the times in the trace
+  Clock::time_point created;
+  // Render time of the runs before a resume
+  double elapsedBefore = 0.0;
+  static std::atomic<bool> stopRequested;
+};
@@ -1,14 +1,14 @@
 #include "scene.h"
 
+#include <iostream>
 #include <vector>
 
-#define STB_IMAGE_IMPLEMENTATION
+#include "core/parallel.h"
+#include "io/mesh_cache.h"
+#include "io/texture_cache.h"
 #include "smartpointerhelp.h"
-#include "stb_image.h"
 
-void final_scene(Scene *scene) {
-  int l = 0;
-  Hitable **list = new Hitable *[30];
+void final_scene(Scene *scene, raytracer::RNG &rng) {
   // Ground
   int b = 0;
   int nb = 20;
@@ -22,72 +22,73 @@ void final_scene(Scene *scene) {
       float z0 = -1000 + j * w;
       float y0 = 0;
       float x1 = x0 + w;
-      float y1 = 100 * (drand48() + 0.01);
+      float y1 = 100 * (rng.uniformFloat() + 0.01);
       float z1 = z0 + w;
       boxlist[i * nb + j] = mkS<box>(vec3(x0, y0, z0), vec3(x1, y1, z1), ground);
     }
   }
-  list[l++] = new BVH(boxlist, 0, 1, SplitMethod::EqualCounts);
+  scene->add(new BVH(boxlist, 0, 1, SplitMethod::EqualCounts));
 
   // Top light
   material *light = new diffuse_light(new constant_texture(vec3(7.f)));
   scene->light = new xz_rect(123, 423, 147, 412, 554, light);
-  list[l++] = new flip_normals(scene->light);
+  scene->add(new flip_normals(scene->light));
 
   // Foam Box
   int ns = 1000;
   std::vector<sPtr<Hitable>> boxlist2(ns);
   material *white = new lambertian(new constant_texture(vec3(0.73f)));
   for (int i = 0; i < ns; i++) {
-    boxlist2[i] = mkS<sphere>(vec3(165 * drand48(), 165 * drand48(), 165 * drand48()), 10, white);
+    // One draw per statement, the order of arguments is unspecified
+    float x = 165 * rng.uniformFloat();
+    float y = 165 * rng.uniformFloat();
+    float z = 165 * rng.uniformFloat();
+    boxlist2[i] = mkS<sphere>(vec3(x, y, z), 10, white);
   }
-  list[l++] =
-      new translate(new rotate_y(new BVH(boxlist2, 0.0, 1.0, SplitMethod::EqualCounts), 15), vec3(-100, 270, 395));
+  scene->add(new translate(new rotate_y(new BVH(boxlist2, 0.0, 1.0, SplitMethod::EqualCounts), 15),
+                           vec3(-100, 270, 395)));
 
   // Moving sphere
   vec3 center(400, 400, 200);
-  list[l++] = new moving_sphere(center, center + vec3(30, 0, 0), 0, 1, 50,
-                                new lambertian(new constant_texture(vec3(0.7, 0.3, 0.1))));
+  scene->add(new moving_sphere(center, center + vec3(30, 0, 0), 0, 1, 50,
+                               new lambertian(new constant_texture(vec3(0.7, 0.3, 0.1)))));
 
   // Glass
-  list[l++] = new sphere(vec3(260, 150, 45), 50, new dielectric(1.5));
+  scene->add(new sphere(vec3(260, 150, 45), 50, new dielectric(1.5)));
 
   // Metal
-  list[l++] = new sphere(vec3(0, 150, 145), 50, new metal(vec3(0.8, 0.8, 0.9), 10.0));
+  scene->add(new sphere(vec3(0, 150, 145), 50, new metal(vec3(0.8, 0.8, 0.9), 10.0)));
 
   // Constant medium
   Hitable *boundary = new sphere(vec3(360, 150, 145), 70, new dielectric(1.5));
-  list[l++] = boundary;
-  list[l++] = new constant_medium(boundary, 0.2, new constant_texture(vec3(0.2, 0.4, 0.9)));
+  scene->add(boundary);
+  scene->add(new constant_medium(boundary, 0.2, new constant_texture(vec3(0.2, 0.4, 0.9))));
   boundary = new sphere(vec3(0, 0, 0), 5000, new dielectric(1.5));
-  list[l++] = new constant_medium(boundary, 0.0001, new constant_texture(vec3(1.0, 1.0, 1.0)));
+  scene->add(new constant_medium(boundary, 0.0001, new constant_texture(vec3(1.0, 1.0, 1.0))));
 
   // Noise
   texture *pertext = new noise_texture(0.1);
-  list[l++] = new sphere(vec3(220, 280, 300), 80, new lambertian(pertext));
-  scene->world = new hitable_list(list, l);
+  scene->add(new sphere(vec3(220, 280, 300), 80, new lambertian(pertext)));
 }
 
-Hitable *cornell_smoke() {
-  Hitable **list = new Hitable *[8];
-  int i = 0;
+void cornell_smoke(Scene *scene) {
   material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
   material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
   material *green = new lambertian(new constant_texture(vec3(0.12, 0.45, 0.15)));
-  material *light = new diffuse_light(new constant_texture(vec3(7, 7, 7)));
-  list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-  list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-  list[i++] = new xz_rect(113, 443, 127, 432, 554, light);
-  list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-  list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-  list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
+  material *lightMat = new diffuse_light(new constant_texture(vec3(7, 7, 7)));
+  scene->add(new flip_normals(new yz_rect(0, 555, 0, 555, 555, green)));
+  scene->add(new yz_rect(0, 555, 0, 555, 0, red));
+  scene->light = new xz_rect(113, 443, 127, 432, 554, lightMat);
+  scene->add(new flip_normals(scene->light));
+  scene->add(new flip_normals(new xz_rect(0, 555, 0, 555, 555, white)));
+  scene->add(new xz_rect(0, 555, 0, 555, 0, white));
+  scene->add(new flip_normals(new xy_rect(0, 555, 0, 555, 555, white)));
   Hitable *b1 = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), white), -18),
                               vec3(130, 0, 65));
   Hitable *b2 = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white), 15),
                               vec3(265, 0, 295));
-  list[i++] = new constant_medium(b1, 0.01, new constant_texture(vec3(1.0, 1.0, 1.0)));
-  list[i++] = new constant_medium(b2, 0.01, new constant_texture(vec3(0.0, 0.0, 0.0)));
-  return new hitable_list(list, i);
+  scene->add(new constant_medium(b1, 0.01, new constant_texture(vec3(1.0, 1.0, 1.0))));
+  scene->add(new constant_medium(b2, 0.01, new constant_texture(vec3(0.0, 0.0, 0.0))));
 }
 
 Hitable *simple_light() {
@@ -102,46 +103,94 @@ Hitable *simple_light() {
 }
 
 void cornell_box(Scene *scene) {
-  Hitable **list = new Hitable *[8];
-  int i = 0;
   material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
   material *white = new lambertian(new constant_texture(vec3(0.73f)));
   material *green = new lambertian(new constant_texture(vec3(0.12, 0.40, 0.15)));
   material *lightMat = new diffuse_light(new constant_texture(vec3(7.f)));
-  list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-  list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
+  scene->add(new flip_normals(new yz_rect(0, 555, 0, 555, 555, green)));
+  scene->add(new yz_rect(0, 555, 0, 555, 0, red));
   Hitable *light_rect = new xz_rect(163, 393, 177, 382, 554, lightMat);
-  list[i++] = new flip_normals(light_rect);
+  scene->add(new flip_normals(light_rect));
   scene->light = light_rect;
-  list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-  list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-  list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-  list[i++] = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), white), -18),
-                            vec3(130, 0, 65));
+  scene->add(new flip_normals(new xz_rect(0, 555, 0, 555, 555, white)));
+  scene->add(new xz_rect(0, 555, 0, 555, 0, white));
+  scene->add(new flip_normals(new xy_rect(0, 555, 0, 555, 555, white)));
+  scene->add(new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), white), -18),
+                           vec3(130, 0, 65)));
   // material *alum = new metal(vec3(0.8, 0.85, 0.88), 0.0);
-  list[i++] = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white), 15),
-                            vec3(265, 0, 295));
+  scene->add(new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white), 15),
+                           vec3(265, 0, 295)));
+}
 
-  scene->world = new hitable_list(list, i);
+// Cornell box with the mesh at path scaled to stand on the floor in the middle.
+// The scaled mesh and its BVH are cached next to the mesh file.
+void cornell_mesh(Scene *scene, const std::string &path) {
+  cornell_box(scene);
+  if (path.empty()) {
+    std::cerr << "The cornell_mesh scene needs a mesh, see --mesh" << std::endl;
+    return;
+  }
+  material *white = new lambertian(new constant_texture(vec3(0.73f)));
+  auto fitIntoBox = [](TriangleMesh &mesh) {
+    aabb bounds;
+    for (const vec3 &p : mesh.p) {
+      bounds.extend(p);
+    }
+    vec3 extent = bounds.max() - bounds.min();
+    float scale = 330.f / std::max(extent.x(), std::max(extent.y(), extent.z()));
+    vec3 base(bounds.getCentroid().x(), bounds.min().y(), bounds.getCentroid().z());
+    for (vec3 &p : mesh.p) {
+      p = (p - base) * scale + vec3(278, 0, 278);
+    }
+  };
+  sPtr<BVH> bvh = loadMeshCached(path, path + ".cornell.rtc", white, SplitMethod::SAH, fitIntoBox,
+                                 "fit 330 at 278,0,278");
+  if (bvh) {
+    scene->add(bvh);
+  }
 }
 
-Hitable *cornell_ball() {
-  Hitable **list = new Hitable *[8];
-  int i = 0;
+void cornell_ball(Scene *scene) {
   material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
   material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
   material *green = new lambertian(new constant_texture(vec3(0.12, 0.40, 0.15)));
-  material *light = new diffuse_light(new constant_texture(vec3(15, 15, 15)));
-  list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-  list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-  list[i++] = new xz_rect(163, 393, 177, 382, 554, light);
-  list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-  list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-  list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-  list[i++] = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white), 15),
-                            vec3(265, 0, 295));
-  list[i++] = new sphere(vec3(190, 90, 190), 90, new dielectric(1.5));
-  return new hitable_list(list, i);
+  material *lightMat = new diffuse_light(new constant_texture(vec3(15, 15, 15)));
+  scene->add(new flip_normals(new yz_rect(0, 555, 0, 555, 555, green)));
+  scene->add(new yz_rect(0, 555, 0, 555, 0, red));
+  scene->light = new xz_rect(163, 393, 177, 382, 554, lightMat);
+  scene->add(new flip_normals(scene->light));
+  scene->add(new flip_normals(new xz_rect(0, 555, 0, 555, 555, white)));
+  scene->add(new xz_rect(0, 555, 0, 555, 0, white));
+  scene->add(new flip_normals(new xy_rect(0, 555, 0, 555, 555, white)));
+  scene->add(new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white), 15),
+                           vec3(265, 0, 295)));
+  scene->add(new sphere(vec3(190, 90, 190), 90, new dielectric(1.5)));
+}
+
+// Cornell box with a cloud of smoke under the light and fog on the floor,
+// both on a density grid that leaves most of the box empty
+void cornell_fog(Scene *scene) {
+  cornell_box(scene);
+  const int res = 64;
+  const float voxel = 555.f / res;
+  std::vector<float> densities(size_t(res) * res * res);
+  perlin noise;
+  raytracer::ParallelFor(
+      [&](int z) {
+        for (int y = 0; y < res; ++y) {
+          for (int x = 0; x < res; ++x) {
+            vec3 p = (vec3(x, y, z) + vec3(0.5f)) * voxel;
+            // Billows fading out towards the edge of a sphere
+            float r = (p - vec3(278, 400, 278)).length() / 130.f;
+            float cloud = r < 1.f ? (1.f - r) * 3.f * noise.turb(p * 0.015f) : 0.f;
+            float fog = p.y() < 60.f ? 0.3f * (1.f - p.y() / 60.f) : 0.f;
+            densities[(size_t(z) * res + y) * res + x] = cloud + fog;
+          }
+        }
+      },
+      res, 1);
+  scene->add(new grid_medium(aabb(vec3(0.f), vec3(555.f)), res, res, res, densities, 0.05f,
+                             new constant_texture(vec3(0.9f))));
 }
 
 Hitable *two_perlin_spheres() {
@@ -152,52 +201,195 @@ Hitable *two_perlin_spheres() {
   return new hitable_list(list, 2);
 }
 
-Hitable *earth() {
-  int nx, ny, nn;
-  // unsigned char *tex_data = stbi_load("tiled.jpg", &nx, &ny, &nn, 0);
-  // unsigned char *tex_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
-  unsigned char *tex_data = stbi_load("earthmap2.png", &nx, &ny, &nn, 0);
-  material *mat = new lambertian(new image_texture(tex_data, nx, ny));
-  return new sphere(vec3(0, 0, 0), 2, mat);
+// The image is tiled on the first run and read on demand through the
+// texture cache, run from the root of the repository
+void earth(Scene *scene) {
+  const std::string path = "assets/earthmap2.png";
+  material *mat = new lambertian(new image_texture(loadTiledImage(path, path + ".rtt")));
+  scene->add(new sphere(vec3(0, 0, 0), 2, mat));
+  material *lightMat = new diffuse_light(new constant_texture(vec3(8.f)));
+  scene->light = new xz_rect(-3, 3, -3, 3, 8, lightMat);
+  scene->add(new flip_normals(scene->light));
 }
 
-Hitable *random_scene() {
-  int n = 200;
-  Hitable **list = new Hitable *[n + 1];
+// The renderer has no sky, an area light above the spheres stands in for it
+void random_scene(Scene *scene, raytracer::RNG &rng) {
   texture *checker = new checker_texture(new constant_texture(vec3(0.2, 0.3, 0.1)),
                                          new constant_texture(vec3(0.9, 0.9, 0.9)));
-  list[0] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));
-  int i = 1;
+  scene->add(new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker)));
+  material *lightMat = new diffuse_light(new constant_texture(vec3(4.f)));
+  scene->light = new xz_rect(-10, 10, -10, 10, 15, lightMat);
+  scene->add(new flip_normals(scene->light));
+  // One draw per statement, the order of arguments is unspecified
+  auto randomColor = [&](float lo, float scale, bool squared) {
+    float c[3];
+    for (float &v : c) {
+      v = rng.uniformFloat();
+      v = squared ? v * rng.uniformFloat() : lo + scale * v;
+    }
+    return vec3(c[0], c[1], c[2]);
+  };
   for (int a = -10; a < 10; a++) {
     for (int b = -10; b < 10; b++) {
-      float choose_mat = drand48();
-      vec3 center(a + 0.9 * drand48(), 0.2, b + 0.9 * drand48());
+      float choose_mat = rng.uniformFloat();
+      float x = a + 0.9 * rng.uniformFloat();
+      float z = b + 0.9 * rng.uniformFloat();
+      vec3 center(x, 0.2, z);
       if ((center - vec3(4, 0.2, 0)).length() <= 0.9) {
         continue;
       }
       if (choose_mat < 0.8) {
-        material *mat = new lambertian(new constant_texture(
-            vec3(drand48() * drand48(), drand48() * drand48(), drand48() * drand48())));
-        list[i++] =
-            new moving_sphere(center, center + vec3(0, 0.5 * drand48(), 0), 0.0, 1.0, 0.2, mat);
+        material *mat = new lambertian(new constant_texture(randomColor(0.f, 1.f, true)));
+        float rise = 0.5 * rng.uniformFloat();
+        scene->add(new moving_sphere(center, center + vec3(0, rise, 0), 0.0, 1.0, 0.2, mat));
       } else if (choose_mat < 0.95) {
-        list[i++] = new sphere(
-            center, 0.2,
-            new metal(vec3(0.5 * (1 + drand48()), 0.5 * (1 + drand48()), 0.5 * (1 + drand48())),
-                      0.5 * drand48()));
+        vec3 albedo = randomColor(0.5f, 0.5f, false);
+        scene->add(new sphere(center, 0.2, new metal(albedo, 0.5 * rng.uniformFloat())));
       } else {
-        list[i++] = new sphere(center, 0.2, new dielectric(1.5));
+        scene->add(new sphere(center, 0.2, new dielectric(1.5)));
       }
     }
   }
   material *mat = new lambertian(new constant_texture(vec3(0.4, 0.2, 0.1)));
-  list[i++] = new sphere(vec3(-4, 1, 0), 1.0, mat);
-  list[i++] = new sphere(vec3(0, 1, 0), 1.0, new dielectric(1.5));
-  list[i++] = new sphere(vec3(4, 1, 0), 1.0, new metal(vec3(0.7, 0.6, 0.5), 0.0));
-  return new hitable_list(list, i);
+  scene->add(new sphere(vec3(-4, 1, 0), 1.0, mat));
+  scene->add(new sphere(vec3(0, 1, 0), 1.0, new dielectric(1.5)));
+  scene->add(new sphere(vec3(4, 1, 0), 1.0, new metal(vec3(0.7, 0.6, 0.5), 0.0)));
 }
 
-Scene::Scene() : world(), light() {
-  // cornell_box(this);
-  final_scene(this);
+// A checkerboard image on a floor that runs to the horizon, where each pixel
+// covers many texels
+void textured_plane(Scene *scene) {
+  const int size = 512, squares = 64;
+  std::vector<unsigned char> pixels(size * size * 3);
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      bool dark = (x * squares / size + y * squares / size) % 2;
+      unsigned char *p = &pixels[(y * size + x) * 3];
+      p[0] = dark ? 30 : 230;
+      p[1] = dark ? 60 : 220;
+      p[2] = dark ? 90 : 200;
+    }
+  }
+  material *floor = new lambertian(new image_texture(pixels.data(), size, size));
+  scene->add(new xz_rect(-100, 100, -100, 100, 0, floor));
+  material *lightMat = new diffuse_light(new constant_texture(vec3(6.f)));
+  scene->light = new xz_rect(-60, 60, -60, 60, 40, lightMat);
+  scene->add(new flip_normals(scene->light));
+}
+
+// Cornell box camera, and the view from the front and above the random spheres
+static const vec3 kCornellFrom(278, 278, -600), kCornellAt(278, 278, 0);
+
+static const SceneInfo kScenes[] = {
+    {"final_scene", [](Scene *s, raytracer::RNG &rng) { final_scene(s, rng); }, kCornellFrom,
+     kCornellAt, 50.f},
+    {"cornell_box", [](Scene *s, raytracer::RNG &) { cornell_box(s); }, kCornellFrom, kCornellAt,
+     50.f},
+    {"cornell_smoke", [](Scene *s, raytracer::RNG &) { cornell_smoke(s); }, kCornellFrom,
+     kCornellAt, 50.f},
+    {"cornell_ball", [](Scene *s, raytracer::RNG &) { cornell_ball(s); }, kCornellFrom,
+     kCornellAt, 50.f},
+    {"cornell_fog", [](Scene *s, raytracer::RNG &) { cornell_fog(s); }, kCornellFrom, kCornellAt,
+     50.f},
+    {"cornell_mesh", [](Scene *s, raytracer::RNG &) { cornell_mesh(s, s->mesh); }, kCornellFrom,
+     kCornellAt, 50.f},
+    {"random_scene", [](Scene *s, raytracer::RNG &rng) { random_scene(s, rng); },
+     vec3(13, 2, 3), vec3(0, 0, 0), 20.f},
+    {"earth", [](Scene *s, raytracer::RNG &) { earth(s); }, vec3(13, 2, 3), vec3(0, 0, 0), 20.f},
+    {"textured_plane", [](Scene *s, raytracer::RNG &) { textured_plane(s); }, vec3(0, 3, -95),
+     vec3(0, 0, -75), 40.f},
+};
+
+const SceneInfo *findScene(const std::string &name) {
+  for (const SceneInfo &info : kScenes) {
+    if (name == info.name) {
+      return &info;
+    }
+  }
+  return nullptr;
+}
+
+std::vector<std::string> sceneNames() {
+  std::vector<std::string> names;
+  for (const SceneInfo &info : kScenes) {
+    names.push_back(info.name);
+  }
+  return names;
+}
+
+Scene::Scene(const std::string &name, uint64_t seed, const std::string &mesh)
+    : world(), light(), name(name), mesh(mesh) {
+  const SceneInfo *info = findScene(name);
+  raytracer::RNG rng(seed);
+  (info ? info : &kScenes[0])->build(this, rng);
+  buildWorld();
+}
+
+void Scene::add(Hitable *object) { objects.emplace_back(object); }
+
+void Scene::add(sPtr<Hitable> object) { objects.push_back(std::move(object)); }
+
+static const BVH *findBVH(const Hitable *h) {
+  while (h) {
+    if (const BVH *bvh = dynamic_cast<const BVH *>(h)) {
+      return bvh;
+    } else if (const translate *t = dynamic_cast<const translate *>(h)) {
+      h = t->ptr;
+    } else if (const rotate_y *r = dynamic_cast<const rotate_y *>(h)) {
+      h = r->ptr;
+    } else if (const flip_normals *f = dynamic_cast<const flip_normals *>(h)) {
+      h = f->ptr;
+    } else {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+void Scene::reportBVHs(std::ostream &out) const {
+  auto splitName = [](const BVH &bvh) {
+    return bvh.getSplitMethod() == SplitMethod::SAH ? "SAH" : "equal counts";
+  };
+  if (topLevel) {
+    out << "Top level BVH, " << splitName(*topLevel) << ": " << topLevel->getQuality();
+  }
+  for (size_t i = 0; i < objects.size(); ++i) {
+    if (const BVH *bvh = findBVH(objects[i].get())) {
+      out << "Object " << i << " BVH, " << splitName(*bvh) << ": " << bvh->getQuality();
+    }
+  }
+}
+
+void Scene::buildWorld() {
+  std::vector<aabb> boxes(objects.size());
+  std::vector<bool> bounded(objects.size());
+  aabb all;
+  for (size_t i = 0; i < objects.size(); ++i) {
+    bounded[i] = objects[i]->bounding_box(0, 1, boxes[i]);
+    if (bounded[i]) {
+      all.extend(boxes[i]);
+    }
+  }
+  // A box containing the union of all boxes can only be the enclosing object
+  std::vector<sPtr<Hitable>> inTree;
+  std::vector<Hitable *> sideList;
+  for (size_t i = 0; i < objects.size(); ++i) {
+    bool encloses = objects.size() > 1 && bounded[i] && boxes[i].contains(all);
+    if (bounded[i] && !encloses) {
+      inTree.push_back(objects[i]);
+    } else {
+      sideList.push_back(objects[i].get());
+    }
+  }
+  if (!inTree.empty()) {
+    topLevel = mkS<BVH>(inTree, 0, 1, SplitMethod::SAH);
+    sideList.insert(sideList.begin(), topLevel.get());
+  }
+  if (sideList.size() == 1) {
+    world = sideList[0];
+    return;
+  }
+  Hitable **list = new Hitable *[sideList.size()];
+  std::copy(sideList.begin(), sideList.end(), list);
+  world = new hitable_list(list, sideList.size());
 }
@@ -1,14 +1,53 @@
 #pragma once
 
+#include <ostream>
+#include <string>
+#include <vector>
+
 #include "hitable.h"
 #include "material.h"
 #include "accelerators/bvh.h"
 #include "box.h"
+#include "core/rng.h"
+#include "smartpointerhelp.h"
 #include "sphere.h"
 #include "medium.h"
 
+// Top-level objects are added with add and owned by the scene. buildWorld
+// puts every bounded object into a BVH, so the cost per ray grows with the
+// log of the object count. Objects without a box, or whose box encloses all
+// the others such as a fog volume around the scene, would sit at the root
+// of any tree anyway and are kept in a short list next to it.
 class Scene {
 public:
-    Scene();
+    // One of the built-in scenes, final_scene if there is none of that name.
+    // Random placements draw from a generator with the given seed, so a
+    // scene is the same in every process. mesh is the OBJ or PLY file of the
+    // cornell_mesh scene.
+    explicit Scene(const std::string &name = "final_scene", uint64_t seed = 0,
+                   const std::string &mesh = "");
+    void add(Hitable *object);
+    void add(sPtr<Hitable> object);
+    void buildWorld();
+    // Quality of the top level BVH and of the BVHs among the objects, also
+    // when placed through transforms
+    void reportBVHs(std::ostream &out) const;
     Hitable *world, *light;
+    std::string name, mesh;
+
+private:
+    std::vector<sPtr<Hitable>> objects;
+    sPtr<BVH> topLevel;
 };
+
+// A built-in scene and the camera it is meant to be seen with
+struct SceneInfo {
+    const char *name;
+    void (*build)(Scene *scene, raytracer::RNG &rng);
+    vec3 lookFrom, lookAt;
+    float vfov;
+};
+
+// nullptr for an unknown name
+const SceneInfo *findScene(const std::string &name);
+std::vector<std::string> sceneNames();
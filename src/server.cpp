@@ -0,0 +1,110 @@
+#include "server.h"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "io/socket.h"
+#include "renderer.h"
+
+RenderServer::RenderServer(const Scene &scene, const Options &defaults)
+    : scene(scene), defaults(defaults) {
+  this->defaults.serve.clear();
+}
+
+std::string RenderServer::runJob(const std::string &line, bool &quit) {
+  std::istringstream stream(line);
+  std::vector<std::string> args = {"job"};
+  std::string arg;
+  while (stream >> arg) {
+    args.push_back(arg);
+  }
+  if (args.size() == 1) {
+    return "";
+  }
+  if (args.size() == 2 && args[1] == "quit") {
+    quit = true;
+    return "ok quit";
+  }
+  std::vector<char *> argv;
+  for (std::string &a : args) {
+    argv.push_back(&a[0]);
+  }
+  Options options = defaults;
+  if (!parseOptions(argv.size(), argv.data(), options)) {
+    return "error invalid options";
+  }
+  if (!options.coordinator.empty() || !options.worker.empty() || !options.serve.empty() ||
+      !options.benchmark.empty()) {
+    return "error jobs cannot start other processes";
+  }
+  if (options.scene != scene.name || options.mesh != scene.mesh) {
+    return "error the server renders " + scene.name + (scene.mesh.empty() ? "" : " " + scene.mesh);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  Renderer renderer(&scene, makeCamera(options), options);
+  if (options.resume && !renderer.loadCheckpoint(options.checkpoint)) {
+    return "error cannot resume from " + options.checkpoint;
+  }
+  renderer.render(writer);
+  if (!writer.wait()) {
+    return "error writing " + options.output + " failed";
+  }
+  std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+  std::ostringstream reply;
+  reply << "ok " << options.output << " " << renderer.getSamplesPerPixel() << " "
+        << seconds.count();
+  return reply.str();
+}
+
+bool RenderServer::serve(const std::string &address) {
+  bool quit = false;
+  if (address == "-") {
+    // Replies own stdout, the progress messages of the renderer go to stderr
+    std::ostream replies(std::cout.rdbuf());
+    std::streambuf *coutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+    std::string line;
+    while (!quit && std::getline(std::cin, line)) {
+      std::string reply = runJob(line, quit);
+      if (!reply.empty()) {
+        replies << reply << std::endl;
+      }
+    }
+    std::cout.rdbuf(coutBuffer);
+    return true;
+  }
+
+  Socket server = Socket::listen(address);
+  if (!server.valid()) {
+    return false;
+  }
+  std::cout << "Waiting for jobs on " << address << std::endl;
+  // Accepting fails when out of file descriptors or when a client gives up
+  // early, which usually passes. Wait between attempts rather than spin on
+  // the error, and give up when it lasts about 10 seconds.
+  const int kMaxFailures = 100;
+  int failures = 0;
+  while (!quit) {
+    Socket client = server.accept();
+    if (!client.valid()) {
+      if (++failures >= kMaxFailures) {
+        std::cerr << "Giving up on " << address << std::endl;
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    failures = 0;
+    std::string line;
+    while (!quit && client.valid() && client.receiveLine(line)) {
+      std::string reply = runJob(line, quit);
+      if (!reply.empty() && !client.sendAll((reply + "\n").data(), reply.size() + 1)) {
+        break;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "io/image_io.h"
+#include "options.h"
+#include "scene.h"
+
+// Keeps a scene, its BVH and the thread pool alive and renders one image per
+// job, so a job only pays for tracing. A job is a line of the command line
+// options of the renderer, applied on top of the options the server was
+// started with, e.g.
+//   --lookfrom 0,50,-600 --resolution 400x400 --spp 64 -o frame1.png
+// Jobs come from stdin for the address "-", otherwise from clients connecting
+// to the socket address, one client at a time. Every job is answered with a
+// single line, "ok OUTPUT SPP SECONDS" or "error MESSAGE". "quit" stops the
+// server.
+class RenderServer {
+public:
+  RenderServer(const Scene &scene, const Options &defaults);
+
+  bool serve(const std::string &address);
+
+private:
+  // Returns the reply, or an empty string for a line that is not a job
+  std::string runJob(const std::string &line, bool &quit);
+
+  const Scene &scene;
+  Options defaults;
+  AsyncImageWriter writer;
+};
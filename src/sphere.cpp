@@ -52,6 +52,7 @@ bool sphere::hit(const Ray& r, float t_min, float t_max,
       rec.p = r.point_at_parameter(rec.t);
       get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
       rec.normal = (rec.p - center) / radius;
+      get_sphere_uv_scale(rec.normal, radius, rec.dpdu, rec.dpdv);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -61,6 +62,7 @@ bool sphere::hit(const Ray& r, float t_min, float t_max,
       rec.p = r.point_at_parameter(rec.t);
       get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
       rec.normal = (rec.p - center) / radius;
+      get_sphere_uv_scale(rec.normal, radius, rec.dpdu, rec.dpdv);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -95,6 +97,8 @@ bool moving_sphere::hit(const Ray& r, float t_min, float t_max,
       rec.t = temp;
       rec.p = r.point_at_parameter(rec.t);
       rec.normal = (rec.p - center(r.time())) / radius;
+      get_sphere_uv(rec.normal, rec.u, rec.v);
+      get_sphere_uv_scale(rec.normal, radius, rec.dpdu, rec.dpdv);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -103,6 +107,8 @@ bool moving_sphere::hit(const Ray& r, float t_min, float t_max,
       rec.t = temp;
       rec.p = r.point_at_parameter(rec.t);
       rec.normal = (rec.p - center(r.time())) / radius;
+      get_sphere_uv(rec.normal, rec.u, rec.v);
+      get_sphere_uv_scale(rec.normal, radius, rec.dpdu, rec.dpdv);
       rec.mat_ptr = mat_ptr;
       return true;
     }
@@ -1,6 +1,8 @@
 #ifndef SPHEREH
 #define SPHEREH
 
+#include <algorithm>
+
 #include "hitable.h"
 
 inline void get_sphere_uv(const vec3& p, float& u, float& v) {
@@ -10,6 +12,13 @@ inline void get_sphere_uv(const vec3& p, float& u, float& v) {
   v = (theta + M_PI / 2) / M_PI;
 }
 
+// Lengths of the steps in u and v at the point with unit normal n, u going
+// around the circle of latitude and v from pole to pole
+inline void get_sphere_uv_scale(const vec3& n, float radius, float& dpdu, float& dpdv) {
+  dpdu = 2 * M_PI * radius * sqrt(std::max(0.f, 1.f - n.y() * n.y()));
+  dpdv = M_PI * radius;
+}
+
 class sphere : public Hitable {
  public:
   sphere() {}
@@ -0,0 +1,217 @@
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "core/parallel.h"
+#include "io/texture_cache.h"
+
+void texture::values(const TextureBatch &batch, vec3 *out) const {
+  for (int i = 0; i < batch.count; ++i) {
+    out[i] = batch.du ? value(batch.u[i], batch.v[i], batch.p[i], batch.du[i], batch.dv[i])
+                      : value(batch.u[i], batch.v[i], batch.p[i]);
+  }
+}
+
+void constant_texture::values(const TextureBatch &batch, vec3 *out) const {
+  std::fill(out, out + batch.count, color);
+}
+
+void checker_texture::values(const TextureBatch &batch, vec3 *out) const {
+  // The side of every lookup, then the even ones followed by the odd ones,
+  // without branches on the sides
+  std::vector<int> index(batch.count + 1);
+  std::vector<uint8_t> sides(batch.count);
+  for (int i = 0; i < batch.count; ++i) {
+    sides[i] = isOdd(batch.p[i]);
+  }
+  int evens = 0;
+  for (int i = 0; i < batch.count; ++i) {
+    index[evens] = i;
+    evens += 1 - sides[i];
+  }
+  int odds = evens;
+  for (int i = 0; i < batch.count; ++i) {
+    index[odds] = i;
+    odds += sides[i];
+  }
+  if (evens == batch.count || evens == 0) {
+    // All on one side, the batch goes through as it is
+    (evens == batch.count ? even : odd)->values(batch, out);
+    return;
+  }
+  // Gather the lookups of each side, evaluate them and scatter the results
+  bool footprints = batch.du != nullptr;
+  std::vector<float> u(batch.count), v(batch.count);
+  std::vector<float> du(footprints ? batch.count : 0), dv(footprints ? batch.count : 0);
+  std::vector<vec3> p(batch.count), result(batch.count);
+  for (int k = 0; k < batch.count; ++k) {
+    int i = index[k];
+    u[k] = batch.u[i];
+    v[k] = batch.v[i];
+    p[k] = batch.p[i];
+    if (footprints) {
+      du[k] = batch.du[i];
+      dv[k] = batch.dv[i];
+    }
+  }
+  const int first[2] = {0, evens};
+  const texture *children[2] = {even, odd};
+  for (int side = 0; side < 2; ++side) {
+    TextureBatch part;
+    part.count = side == 0 ? evens : batch.count - evens;
+    part.u = &u[first[side]];
+    part.v = &v[first[side]];
+    part.p = &p[first[side]];
+    part.du = footprints ? &du[first[side]] : nullptr;
+    part.dv = footprints ? &dv[first[side]] : nullptr;
+    children[side]->values(part, &result[first[side]]);
+  }
+  for (int k = 0; k < batch.count; ++k) {
+    out[index[k]] = result[k];
+  }
+}
+
+void noise_texture::values(const TextureBatch &batch, vec3 *out) const {
+  std::vector<float> turb(batch.count);
+  noise.turb(batch.p, batch.count, turb.data());
+  for (int i = 0; i < batch.count; ++i) {
+    out[i] = vec3(1, 1, 1) * 0.5 * (1 + sin(scale * batch.p[i].z() + 10 * turb[i]));
+  }
+}
+
+void baked_noise_texture::values(const TextureBatch &batch, vec3 *out) const {
+  for (int i = 0; i < batch.count; ++i) {
+    out[i] = baked_noise_texture::value(batch.u[i], batch.v[i], batch.p[i]);
+  }
+}
+
+baked_noise_texture::baked_noise_texture(float sc, const aabb &bounds, int resolution)
+    : scale(sc), origin(bounds.min()) {
+  vec3 size = bounds.max() - bounds.min();
+  float longest = std::max(size.x(), std::max(size.y(), size.z()));
+  density = (std::max(resolution, 2) - 1) / longest;
+  nx = std::max(2, int(std::ceil(size.x() * density)) + 1);
+  ny = std::max(2, int(std::ceil(size.y() * density)) + 1);
+  nz = std::max(2, int(std::ceil(size.z() * density)) + 1);
+  samples.resize(size_t(nx) * ny * nz);
+  perlin noise;
+  raytracer::ParallelFor(
+      [&](int z) {
+        for (int y = 0; y < ny; ++y) {
+          for (int x = 0; x < nx; ++x) {
+            samples[(size_t(z) * ny + y) * nx + x] =
+                noise.turb(origin + vec3(x, y, z) / density);
+          }
+        }
+      },
+      nz, 1);
+}
+
+float baked_noise_texture::turb(const vec3 &p) const {
+  vec3 g = (p - origin) * density;
+  float c[3];
+  int i[3];
+  const int n[3] = {nx, ny, nz};
+  for (int a = 0; a < 3; ++a) {
+    float t = std::min(std::max(g[a], 0.f), float(n[a] - 1));
+    i[a] = std::min(int(t), n[a] - 2);
+    c[a] = t - i[a];
+  }
+  const float *s = &samples[(size_t(i[2]) * ny + i[1]) * nx + i[0]];
+  size_t dy = nx, dz = size_t(nx) * ny;
+  float x00 = s[0] + c[0] * (s[1] - s[0]);
+  float x10 = s[dy] + c[0] * (s[dy + 1] - s[dy]);
+  float x01 = s[dz] + c[0] * (s[dz + 1] - s[dz]);
+  float x11 = s[dz + dy] + c[0] * (s[dz + dy + 1] - s[dz + dy]);
+  float y0 = x00 + c[1] * (x10 - x00), y1 = x01 + c[1] * (x11 - x01);
+  return y0 + c[2] * (y1 - y0);
+}
+
+image_texture::image_texture(const unsigned char *pixels, int A, int B, int channels)
+    : nx(A), ny(B) {
+  if (!pixels || nx <= 0 || ny <= 0) {
+    nx = ny = 0;
+    return;
+  }
+  texels.reserve(size_t(nx) * ny * 4);
+  for (size_t i = 0; i < size_t(nx) * ny; ++i) {
+    const unsigned char *p = pixels + i * channels;
+    // Grey, with or without alpha
+    texels.insert(texels.end(), {p[0], p[channels < 3 ? 0 : 1], p[channels < 3 ? 0 : 2]});
+  }
+  mips = raytracer::buildMipmap(texels, nx, ny);
+}
+
+image_texture::image_texture(sPtr<const TiledImage> image) : tiled(image) {
+  if (tiled) {
+    mips = tiled->getLevels();
+    nx = mips[0].width;
+    ny = mips[0].height;
+  }
+}
+
+void image_texture::texel(int level, int x, int y, uint8_t rgb[3]) const {
+  if (tiled) {
+    tiled->texel(level, x, y, rgb);
+    return;
+  }
+  const raytracer::MipLevel &l = mips[level];
+  const uint8_t *t = &texels[l.offset + (size_t(y) * l.width + x) * 3];
+  std::copy(t, t + 3, rgb);
+}
+
+vec3 image_texture::bilinear(int level, float u, float v) const {
+  const raytracer::MipLevel &l = mips[level];
+  // Texel centers sit at half integers, rows go down while v goes up
+  float s = u * l.width - 0.5f, t = (1.f - v) * l.height - 0.5f;
+  float fs = std::floor(s), ft = std::floor(t);
+  float ds = s - fs, dt = t - ft;
+  int x0 = std::min(std::max(int(fs), 0), l.width - 1);
+  int x1 = std::min(std::max(int(fs) + 1, 0), l.width - 1);
+  int y0 = std::min(std::max(int(ft), 0), l.height - 1);
+  int y1 = std::min(std::max(int(ft) + 1, 0), l.height - 1);
+  uint8_t c00[3], c10[3], c01[3], c11[3];
+  texel(level, x0, y0, c00);
+  texel(level, x1, y0, c10);
+  texel(level, x0, y1, c01);
+  texel(level, x1, y1, c11);
+  float c[3];
+  for (int k = 0; k < 3; ++k) {
+    float top = (1.f - ds) * c00[k] + ds * c10[k];
+    float bottom = (1.f - ds) * c01[k] + ds * c11[k];
+    c[k] = ((1.f - dt) * top + dt * bottom) * (1.f / 255.f);
+  }
+  return vec3(c[0], c[1], c[2]);
+}
+
+vec3 image_texture::value(float u, float v, const vec3 &) const {
+  return mips.empty() ? vec3(0.f) : bilinear(0, u, v);
+}
+
+vec3 image_texture::value(float u, float v, const vec3 &p, float du, float dv) const {
+  if (mips.empty()) {
+    return vec3(0.f);
+  }
+  // Footprint in texels of the finest level, along its longer axis
+  float width = std::max(du * nx, dv * ny);
+  if (!(width > 1.f)) {
+    return bilinear(0, u, v);
+  }
+  float level = std::min(std::log2(width), float(mips.size() - 1));
+  int l0 = int(level);
+  float f = level - l0;
+  vec3 c = bilinear(l0, u, v);
+  if (f > 0.f && l0 + 1 < int(mips.size())) {
+    c = (1.f - f) * c + f * bilinear(l0 + 1, u, v);
+  }
+  return c;
+}
+
+void image_texture::values(const TextureBatch &batch, vec3 *out) const {
+  for (int i = 0; i < batch.count; ++i) {
+    out[i] = batch.du ? image_texture::value(batch.u[i], batch.v[i], batch.p[i], batch.du[i],
+                                             batch.dv[i])
+                      : image_texture::value(batch.u[i], batch.v[i], batch.p[i]);
+  }
+}
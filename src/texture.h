@@ -1,12 +1,39 @@
 #ifndef TEXTUREH
 #define TEXTUREH
 
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "core/mipmap.h"
 #include "ray.h"
 #include "perlin.h"
+#include "smartpointerhelp.h"
+
+class TiledImage;
+
+// A group of lookups, e.g. the hit points of the rays that share a material,
+// as arrays of count elements each. du and dv are null for lookups without a
+// footprint.
+struct TextureBatch {
+    int count = 0;
+    const float *u = nullptr, *v = nullptr;
+    const vec3 *p = nullptr;
+    const float *du = nullptr, *dv = nullptr;
+};
 
 class texture {
     public:
         virtual vec3 value(float u, float v, const vec3& p) const = 0;
+        // Averaged over a footprint of du by dv around (u, v). Only textures
+        // that can filter override it.
+        virtual vec3 value(float u, float v, const vec3& p, float du, float dv) const {
+            return value(u, v, p);
+        }
+        // The value of every lookup of the batch, the same as value() gives
+        // for each, with one virtual call for the batch instead of one or
+        // more per lookup. The default just loops over value().
+        virtual void values(const TextureBatch &batch, vec3 *out) const;
 };
 
 class constant_texture : public texture {
@@ -16,6 +43,7 @@ class constant_texture : public texture {
         virtual vec3 value(float u, float v, const vec3& p) const {
             return color;
         }
+        virtual void values(const TextureBatch &batch, vec3 *out) const;
         vec3 color;
 };
 
@@ -24,8 +52,34 @@ class checker_texture : public texture {
         checker_texture() {}
         checker_texture(texture *t0, texture *t1): even(t0), odd(t1) {}
         virtual vec3 value(float u, float v, const vec3& p)  const {
-            float sines = sin(10*p.x()) * sin(10*p.y())*sin(10*p.z());
-            return sines < 0 ? odd->value(u, v, p) : even->value(u, v, p);
+            return isOdd(p) ? odd->value(u, v, p) : even->value(u, v, p);
+        }
+        virtual vec3 value(float u, float v, const vec3& p, float du, float dv) const {
+            return isOdd(p) ? odd->value(u, v, p, du, dv) : even->value(u, v, p, du, dv);
+        }
+        // Splits the batch by side and hands each child one batch of its
+        // lookups
+        virtual void values(const TextureBatch &batch, vec3 *out) const;
+        // Whether sin(10 x) sin(10 y) sin(10 z) < 0
+        static bool isOdd(const vec3& p) {
+            return sinSign(10*p.x()) * sinSign(10*p.y()) * sinSign(10*p.z()) < 0;
+        }
+        // The sign of sin(t) without computing it: negative between odd and
+        // even multiples of pi. Next to a multiple, or for t so large that
+        // t / pi is off by more than that, sin decides.
+        static int sinSign(float t) {
+            double q = t * (1 / M_PI);
+            if (std::abs(q) < 1e6) {
+                // floor, without the call it is on plain x86-64
+                int64_t n = int64_t(q);
+                n -= q < n;
+                double f = q - n;
+                if (f > 1e-9 && f < 1 - 1e-9) {
+                    return 1 - 2 * int(n & 1);
+                }
+            }
+            double s = sin(t);
+            return (s > 0) - (s < 0);
         }
         texture *even;
         texture *odd;
@@ -39,27 +93,66 @@ class noise_texture : public texture {
             // return vec3(1, 1, 1) * noise.noise(scale * p);
             return vec3(1, 1, 1) * 0.5 *(1 + sin(scale*p.z() + 10*noise.turb(p)));
         }
+        virtual void values(const TextureBatch &batch, vec3 *out) const;
         perlin noise;
         float scale;
 };
 
+// noise_texture with the turbulence baked into a grid over a box and
+// interpolated trilinearly, for a textured object that stays put. A lookup
+// reads 8 floats instead of summing 7 octaves of noise, but detail finer
+// than the grid spacing is lost, so the grid should be at least as fine as a
+// pixel on the object. Points outside the box use the nearest voxel.
+class baked_noise_texture : public texture {
+    public:
+        // The grid has resolution samples along the longest side of bounds
+        baked_noise_texture(float sc, const aabb &bounds, int resolution);
+        virtual vec3 value(float u, float v, const vec3& p) const {
+            return vec3(1, 1, 1) * 0.5 *(1 + sin(scale*p.z() + 10*turb(p)));
+        }
+        virtual void values(const TextureBatch &batch, vec3 *out) const;
+        // The baked approximation of perlin::turb(p)
+        float turb(const vec3 &p) const;
+
+    private:
+        float scale;
+        vec3 origin;
+        // Samples per unit of length
+        float density;
+        int nx, ny, nz;
+        std::vector<float> samples;
+};
+
+// 8 bit RGB image with a mip pyramid built at load time: every level halves
+// the one above with a 2x2 box filter, down to a single texel. Lookups are
+// trilinear, picking the levels whose texels match the footprint, so distant
+// surfaces read from small levels that stay in cache instead of skipping
+// across the full image and aliasing. Coordinates are clamped to the edges.
+// The pyramid is either held in memory or read tile by tile from a tiled
+// file through the TextureCache.
 class image_texture : public texture {
     public:
         image_texture() {}
-        image_texture(unsigned char *pixels, int A, int B) : data(pixels), nx(A), ny(B) {}
-        virtual vec3 value(float u, float v, const vec3 &) const {
-            int i = u * nx;
-            int j = (1- v) * ny - 0.001;
-            if (i < 0) i = 0;
-            if (j < 0) j = 0;
-            if (i > nx - 1) i = nx - 1;
-            if (j > ny - 1) j = ny - 1;
-            float r = int(data[3 * i + 3 * nx * j]) / 255.0;
-            float g = int(data[3 * i + 3 * nx * j + 1]) / 255.0;
-            float b = int(data[3 * i + 3 * nx * j + 2]) / 255.0;
-            return vec3(r, g, b);
-        };
-        unsigned char *data;
-        int nx, ny;
+        // Copies the pixels, rows from the top, with 1 to 4 channels per
+        // pixel. One or two channels are grey, a fourth is ignored.
+        image_texture(const unsigned char *pixels, int A, int B, int channels = 3);
+        // Reads the texels on demand, black when image is null
+        explicit image_texture(sPtr<const TiledImage> image);
+        // The finest level only
+        virtual vec3 value(float u, float v, const vec3 &p) const;
+        virtual vec3 value(float u, float v, const vec3 &p, float du, float dv) const;
+        virtual void values(const TextureBatch &batch, vec3 *out) const;
+
+        int levels() const { return mips.size(); }
+
+    private:
+        vec3 bilinear(int level, float u, float v) const;
+        void texel(int level, int x, int y, uint8_t rgb[3]) const;
+
+        int nx = 0, ny = 0;
+        std::vector<raytracer::MipLevel> mips;
+        // All levels one after the other, 3 bytes per texel, when in memory
+        std::vector<uint8_t> texels;
+        sPtr<const TiledImage> tiled;
 };
 #endif
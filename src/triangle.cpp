@@ -0,0 +1,111 @@
+#include "triangle.h"
+
+#include <cmath>
+#include <utility>
+
+TriangleMesh::TriangleMesh(std::vector<vec3> p, std::vector<uint32_t> indices, material* mat,
+                           std::vector<vec3> n, std::vector<Point2f> uv)
+    : p(std::move(p)), n(std::move(n)), uv(std::move(uv)), indices(std::move(indices)), mat(mat) {}
+
+aabb TriangleMesh::getTriangleBound(int tri) const {
+  const uint32_t* v = &indices[3 * tri];
+  vec3 pMin = Min(Min(p[v[0]], p[v[1]]), p[v[2]]);
+  vec3 pMax = Max(Max(p[v[0]], p[v[1]]), p[v[2]]);
+  // Axis aligned triangles have a flat box, pad it the same way the rects do
+  // so that the slab test does not miss them
+  for (int i = 0; i < 3; ++i) {
+    if (pMax[i] - pMin[i] < 0.0001f) {
+      pMin[i] -= 0.0001f;
+      pMax[i] += 0.0001f;
+    }
+  }
+  return aabb(pMin, pMax);
+}
+
+static int maxDimension(const vec3& v) {
+  return (v[0] > v[1]) ? (v[0] > v[2] ? 0 : 2) : (v[1] > v[2] ? 1 : 2);
+}
+
+static vec3 permute(const vec3& v, int x, int y, int z) { return vec3(v[x], v[y], v[z]); }
+
+bool TriangleMesh::intersect(int tri, const Ray& r, float tMin, float tMax,
+                             HitRecord& rec) const {
+  const uint32_t* v = &indices[3 * tri];
+  const vec3 &p0 = p[v[0]], &p1 = p[v[1]], &p2 = p[v[2]];
+  const vec3 &o = r.A, &dir = r.B;
+
+  // Transform the vertices to a ray space where the ray starts at the origin
+  // and points along +z, so the test reduces to 2d edge functions
+  vec3 p0t = p0 - o, p1t = p1 - o, p2t = p2 - o;
+  int kz = maxDimension(vec3(fabs(dir[0]), fabs(dir[1]), fabs(dir[2])));
+  int kx = kz + 1 == 3 ? 0 : kz + 1;
+  int ky = kx + 1 == 3 ? 0 : kx + 1;
+  vec3 d = permute(dir, kx, ky, kz);
+  p0t = permute(p0t, kx, ky, kz);
+  p1t = permute(p1t, kx, ky, kz);
+  p2t = permute(p2t, kx, ky, kz);
+
+  float sx = -d[0] / d[2], sy = -d[1] / d[2], sz = 1.f / d[2];
+  p0t[0] += sx * p0t[2];
+  p0t[1] += sy * p0t[2];
+  p1t[0] += sx * p1t[2];
+  p1t[1] += sy * p1t[2];
+  p2t[0] += sx * p2t[2];
+  p2t[1] += sy * p2t[2];
+
+  float e0 = p1t[0] * p2t[1] - p1t[1] * p2t[0];
+  float e1 = p2t[0] * p0t[1] - p2t[1] * p0t[0];
+  float e2 = p0t[0] * p1t[1] - p0t[1] * p1t[0];
+  // Fall back to double precision when the ray passes exactly through an edge,
+  // this is what makes the test watertight between neighbouring triangles
+  if (e0 == 0.f || e1 == 0.f || e2 == 0.f) {
+    e0 = (float)((double)p1t[0] * (double)p2t[1] - (double)p1t[1] * (double)p2t[0]);
+    e1 = (float)((double)p2t[0] * (double)p0t[1] - (double)p2t[1] * (double)p0t[0]);
+    e2 = (float)((double)p0t[0] * (double)p1t[1] - (double)p0t[1] * (double)p1t[0]);
+  }
+  if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0)) {
+    return false;
+  }
+  float det = e0 + e1 + e2;
+  if (det == 0.f) {
+    return false;
+  }
+
+  // Compare the scaled distance against the range before paying for the division
+  p0t[2] *= sz;
+  p1t[2] *= sz;
+  p2t[2] *= sz;
+  float tScaled = e0 * p0t[2] + e1 * p1t[2] + e2 * p2t[2];
+  if (det < 0 && (tScaled >= tMin * det || tScaled < tMax * det)) {
+    return false;
+  } else if (det > 0 && (tScaled <= tMin * det || tScaled > tMax * det)) {
+    return false;
+  }
+
+  float invDet = 1.f / det;
+  float b0 = e0 * invDet, b1 = e1 * invDet, b2 = e2 * invDet;
+  rec.t = tScaled * invDet;
+  rec.p = b0 * p0 + b1 * p1 + b2 * p2;
+  if (hasUVs()) {
+    const Point2f &uv0 = uv[v[0]], &uv1 = uv[v[1]], &uv2 = uv[v[2]];
+    rec.u = b0 * uv0.x + b1 * uv1.x + b2 * uv2.x;
+    rec.v = b0 * uv0.y + b1 * uv1.y + b2 * uv2.y;
+    // The same scale along u and v, from the ratio of the areas
+    float worldArea = cross(p1 - p0, p2 - p0).length();
+    float uvArea = std::abs((uv1.x - uv0.x) * (uv2.y - uv0.y) - (uv2.x - uv0.x) * (uv1.y - uv0.y));
+    rec.dpdu = rec.dpdv = uvArea > 0.f ? std::sqrt(worldArea / uvArea) : 0.f;
+  } else {
+    rec.u = b1;
+    rec.v = b2;
+    rec.dpdu = (p1 - p0).length();
+    rec.dpdv = (p2 - p0).length();
+  }
+  if (hasNormals()) {
+    rec.normal = unit_vector(b0 * n[v[0]] + b1 * n[v[1]] + b2 * n[v[2]]);
+  } else {
+    // Counter clockwise winding is the front face
+    rec.normal = unit_vector(cross(p1 - p0, p2 - p0));
+  }
+  rec.mat_ptr = mat;
+  return true;
+}
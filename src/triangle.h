@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/buffer.h"
+#include "hitable.h"
+
+// Vertex data shared by all the triangles of a mesh. Every three entries of
+// indices form one triangle, normals and uvs are optional and are indexed the
+// same way as the positions when present.
+// The mesh itself is not a Hitable, the triangles are exposed to the BVH by
+// their index so no per triangle object is ever allocated. The arrays may be
+// views of a memory mapped mesh cache, see io/mesh_cache.h.
+class TriangleMesh {
+public:
+  TriangleMesh() {}
+  TriangleMesh(std::vector<vec3> p, std::vector<uint32_t> indices, material* mat,
+               std::vector<vec3> n = {}, std::vector<Point2f> uv = {});
+
+  int numTriangles() const { return indices.size() / 3; }
+  bool hasNormals() const { return !n.empty(); }
+  bool hasUVs() const { return !uv.empty(); }
+
+  aabb getTriangleBound(int tri) const;
+  // Watertight ray-triangle intersection, see
+  // Woop et al. 2013, "Watertight Ray/Triangle Intersection"
+  bool intersect(int tri, const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+
+  raytracer::Buffer<vec3> p, n;
+  raytracer::Buffer<Point2f> uv;
+  raytracer::Buffer<uint32_t> indices;
+  material* mat = nullptr;
+};